@@ -0,0 +1,13 @@
+#include "cancellationtoken.h"
+
+CancellationToken::CancellationToken() : canceled(false) {
+
+}
+
+void CancellationToken::cancel() {
+    canceled.store(true, std::memory_order_relaxed);
+}
+
+bool CancellationToken::isCanceled() const {
+    return canceled.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,20 @@
+#ifndef CANCELLATIONTOKEN_H
+#define CANCELLATIONTOKEN_H
+
+#include <atomic>
+#include <memory>
+
+// Shared flag checked cooperatively by a running index build or query.
+class CancellationToken {
+public:
+    CancellationToken();
+
+    void cancel();
+    bool isCanceled() const;
+private:
+    std::atomic<bool> canceled;
+};
+
+typedef std::shared_ptr<CancellationToken> CancellationTokenPtr;
+
+#endif // CANCELLATIONTOKEN_H
@@ -0,0 +1,124 @@
+#include "contenthash.h"
+#include "instrumentation.h"
+#include "resourcegovernor.h"
+
+#include <QFile>
+#include <QtEndian>
+#include <cstring>
+
+static const quint64 PRIME1 = 11400714785074694791ULL,
+                     PRIME2 = 14029467366897019727ULL,
+                     PRIME3 = 1609587929392839161ULL,
+                     PRIME4 = 9650029242287828579ULL,
+                     PRIME5 = 2870177450012600261ULL;
+
+quint64 rotl(quint64 value, int shift) {
+    return (value << shift) | (value >> (64 - shift));
+}
+
+quint64 xxhRound(quint64 acc, quint64 input) {
+    acc += input * PRIME2;
+    acc = rotl(acc, 31);
+    return acc * PRIME1;
+}
+
+quint64 xxhMerge(quint64 hash, quint64 acc) {
+    hash ^= xxhRound(0, acc);
+    return hash * PRIME1 + PRIME4;
+}
+
+ContentHash::ContentHash(quint64 seed) : seed(seed), totalSize(0), bufferSize(0) {
+    acc[0] = seed + PRIME1 + PRIME2;
+    acc[1] = seed + PRIME2;
+    acc[2] = seed;
+    acc[3] = seed - PRIME1;
+}
+
+void ContentHash::consumeStripe(uchar const* stripe) {
+    for (int i = 0; i < 4; i++) {
+        acc[i] = xxhRound(acc[i], qFromLittleEndian<quint64>(stripe + i * 8));
+    }
+}
+
+void ContentHash::update(char const* data, qint64 size) {
+    uchar const* p = reinterpret_cast<uchar const*>(data);
+    uchar const* end = p + size;
+    totalSize += size;
+    if (bufferSize + size < STRIPE_SIZE) {
+        memcpy(buffer + bufferSize, p, size);
+        bufferSize += size;
+        return;
+    }
+    if (bufferSize > 0) {
+        int fill = STRIPE_SIZE - bufferSize;
+        memcpy(buffer + bufferSize, p, fill);
+        consumeStripe(buffer);
+        p += fill;
+        bufferSize = 0;
+    }
+    while (p + STRIPE_SIZE <= end) {
+        consumeStripe(p);
+        p += STRIPE_SIZE;
+    }
+    bufferSize = end - p;
+    memcpy(buffer, p, bufferSize);
+}
+
+quint64 ContentHash::digest() const {
+    quint64 hash;
+    if (totalSize >= STRIPE_SIZE) {
+        hash = rotl(acc[0], 1) + rotl(acc[1], 7) + rotl(acc[2], 12) + rotl(acc[3], 18);
+        for (int i = 0; i < 4; i++) {
+            hash = xxhMerge(hash, acc[i]);
+        }
+    } else {
+        hash = seed + PRIME5;
+    }
+    hash += totalSize;
+    uchar const* p = buffer;
+    uchar const* end = buffer + bufferSize;
+    while (p + 8 <= end) {
+        hash ^= xxhRound(0, qFromLittleEndian<quint64>(p));
+        hash = rotl(hash, 27) * PRIME1 + PRIME4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        hash ^= quint64(qFromLittleEndian<quint32>(p)) * PRIME1;
+        hash = rotl(hash, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    while (p < end) {
+        hash ^= (*p) * PRIME5;
+        hash = rotl(hash, 11) * PRIME1;
+        p++;
+    }
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+bool ContentHash::hashFile(QString const& filePath, quint64 &hash) {
+    ScopedTimer timer(Instrumentation::HASH);
+    Instrumentation::add(Instrumentation::FILES_HASHED);
+    QFile file(filePath);
+    ResourceGovernor::acquireIo(0, 1);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    ContentHash contentHash;
+    QByteArray data;
+    while (!file.atEnd()) {
+        data = file.read(READ_BUFFER_SIZE);
+        if (data.isEmpty() && file.error() != QFileDevice::NoError) {
+            return false;
+        }
+        ResourceGovernor::acquireIo(data.size(), 0);
+        Instrumentation::add(Instrumentation::BYTES_READ, data.size());
+        contentHash.update(data.constData(), data.size());
+    }
+    hash = contentHash.digest();
+    return true;
+}
@@ -0,0 +1,27 @@
+#ifndef CONTENTHASH_H
+#define CONTENTHASH_H
+
+#include <QString>
+
+// Streaming 64-bit xxHash (XXH64) of file contents, used to find identical files.
+class ContentHash {
+public:
+    ContentHash(quint64 seed = 0);
+
+    void update(char const* data, qint64 size);
+    quint64 digest() const;
+
+    static bool hashFile(QString const& filePath, quint64 &hash);
+private:
+    void consumeStripe(uchar const* stripe);
+
+    static const int STRIPE_SIZE = 32,
+                     READ_BUFFER_SIZE = 1 << 16;
+
+    quint64 seed, totalSize;
+    quint64 acc[4];
+    uchar buffer[STRIPE_SIZE];
+    int bufferSize;
+};
+
+#endif // CONTENTHASH_H
@@ -1,8 +1,10 @@
 #include "custommodel.h"
 
+#include <QDir>
+#include <QFileInfo>
 
 CustomModel::CustomModel(QObject *parent): QFileSystemModel(parent){
-    connect(this, &CustomModel::directoryLoaded, this, &CustomModel::checkLoadedDirectory);
+
 }
 
 QVariant CustomModel::data(const QModelIndex& index, int role) const {
@@ -20,109 +22,176 @@ Qt::ItemFlags CustomModel::flags(const QModelIndex& index) const {
     return QFileSystemModel::flags(index) | Qt::ItemIsUserCheckable;
 }
 
-void CustomModel::setMarked(QModelIndex const& index, bool mark) {
-    setChildrenMark(index, mark);
+QString CustomModel::parentPath(QString const& path) {
+    if (path.isEmpty() || path.endsWith('/')) {
+        return QString();
+    }
+    int slash = path.lastIndexOf('/');
+    if (slash < 0) {
+        return QString();
+    }
+    if (slash == 0 || path[slash - 1] == ':') {
+        return path.left(slash + 1);
+    }
+    return path.left(slash);
 }
 
-void CustomModel::setChildrenMark(QModelIndex const& index, bool mark) {
-    QString path = filePath(index);
-    marked[path] = mark;
+void CustomModel::emitSubtreeChanged(QModelIndex const& index) {
     emit dataChanged(index, index);
-    for (int i = 0; i < rowCount(index); i++) {
-        setChildrenMark(this->index(i, 0, index), mark);
+    emitChildrenChanged(index);
+}
+
+void CustomModel::emitChildrenChanged(QModelIndex const& parent) {
+    // one range per loaded directory, directories loaded later read the rules when painted
+    int rows = rowCount(parent);
+    if (rows == 0) {
+        return;
+    }
+    emit dataChanged(index(0, 0, parent), index(rows - 1, 0, parent));
+    for (int row = 0; row < rows; row++) {
+        emitChildrenChanged(index(row, 0, parent));
+    }
+}
+
+void CustomModel::emitAncestorsChanged(QModelIndex const& index) {
+    for (QModelIndex parent = index.parent(); parent.isValid(); parent = parent.parent()) {
+        emit dataChanged(parent, parent);
     }
 }
 
+void CustomModel::setMarked(QModelIndex const& index, bool mark) {
+    QString path = filePath(index);
+    if (mark) {
+        marked.insert(path);
+    } else {
+        marked.remove(path);
+    }
+    emitSubtreeChanged(index);
+}
+
+void CustomModel::clearMarked() {
+    marked.clear();
+    emitChildrenChanged(QModelIndex());
+}
+
 bool CustomModel::isMarked(const QModelIndex &index) const {
-    auto it = marked.find(filePath(index));
-    return (it == marked.end()? false: *it);
+    for (QString path = filePath(index); !path.isEmpty(); path = parentPath(path)) {
+        if (marked.contains(path)) {
+            return true;
+        }
+    }
+    return false;
 }
 
 void CustomModel::setLock(bool _lock) {
     this->lock = _lock;
 }
 
+bool CustomModel::inheritedCheck(QString const& path) const {
+    for (QString ancestor = path; !ancestor.isEmpty(); ancestor = parentPath(ancestor)) {
+        auto it = rules.find(ancestor);
+        if (it != rules.end()) {
+            return *it;
+        }
+    }
+    return false;
+}
+
 int CustomModel::isChecked(const QModelIndex &index) const {
-    int size = checkedNumber[filePath(index)];
-    if (size == 0) {
-        return Qt::Unchecked;
-    } else if (size >= rowCount(index) * 2) {
-        return Qt::Checked;
+    QString path = filePath(index);
+    // a rule below never repeats the state it inherits, so any rule below means mixed content
+    if (rulesBelow.value(path) > 0) {
+        return Qt::PartiallyChecked;
     }
-    return Qt::PartiallyChecked;
+    return inheritedCheck(path) ? Qt::Checked : Qt::Unchecked;
 }
 
-void CustomModel::checkLoadedDirectory(const QString &path) {
-    QModelIndex index = this->index(path);
-    if (marked[path]) {
-        setChildrenMark(index, true);
+void CustomModel::changeRulesBelow(QString const& path, int delta) {
+    for (QString ancestor = parentPath(path); !ancestor.isEmpty(); ancestor = parentPath(ancestor)) {
+        int &count = rulesBelow[ancestor];
+        count += delta;
+        if (count == 0) {
+            rulesBelow.remove(ancestor);
+        }
     }
-    if (checkedNumber[path] > 0) {
-        setChildrenCheck(index, true);
+}
+
+void CustomModel::removeRule(QString const& path) {
+    if (rules.remove(path) > 0) {
+        changeRulesBelow(path, -1);
     }
 }
 
-void CustomModel::setParentCheck(QModelIndex const& index, int prevValue, int currValue) {
-    QString path = filePath(index.parent());
-    int nextPrev = checkedNumber[path];
-    if (currValue == prevValue) return;
-    if (currValue > prevValue) {
-        if (prevValue == 0) {
-            checkedNumber[path] ++;
+void CustomModel::setRule(QString const& path, bool check) {
+    if (rulesBelow.contains(path)) {
+        QString prefix = path.endsWith('/') ? path : path + '/';
+        QVector<QString> below;
+        for (auto it = rules.begin(); it != rules.end(); ++it) {
+            if (it.key().startsWith(prefix)) {
+                below.push_back(it.key());
+            }
         }
-        if (isChecked(index) == Qt::Checked){
-            checkedNumber[path] ++;
-        }
-    } else {
-        if (prevValue >= rowCount(index) * 2 && prevValue > 0) {
-            checkedNumber[path] --;
-        }
-        if (isChecked(index) == Qt::Unchecked){
-            checkedNumber[path] --;
+        for (QString const& rule : below) {
+            removeRule(rule);
         }
     }
-    emit dataChanged(index.parent(), index.parent());
-    if (filePath(index) != "/") {
-        setParentCheck(index.parent(), nextPrev, checkedNumber[filePath(index.parent())]);
+    removeRule(path);
+    if (inheritedCheck(path) != check) {
+        rules.insert(path, check);
+        changeRulesBelow(path, 1);
     }
 }
 
-void CustomModel::setChildrenCheck(QModelIndex const& index, bool check) {
-    QString path = filePath(index);
-    if (check) {
-        checkedNumber[path] = (rowCount(index) == 0? 1: rowCount(index) * 2);
-    } else {
-        checkedNumber[path] = 0;
+QModelIndex CustomModel::collapseRules(QModelIndex index) {
+    // a directory whose children all got the same state one by one takes that state itself
+    for (QModelIndex parent = index.parent(); parent.isValid() && !canFetchMore(parent); parent = parent.parent()) {
+        int state = isChecked(index);
+        if (state == Qt::PartiallyChecked) {
+            break;
+        }
+        bool same = true;
+        for (int row = 0, rows = rowCount(parent); row < rows && same; row++) {
+            same = isChecked(this->index(row, 0, parent)) == state;
+        }
+        if (!same) {
+            break;
+        }
+        setRule(filePath(parent), state == Qt::Checked);
+        index = parent;
     }
-    emit dataChanged(index,index);
-    for (int i = 0; i < rowCount(index); i++) {
-        setChildrenCheck(this->index(i, 0, index), check);
+    return index;
+}
+
+QVector<QString> CustomModel::checkedPaths() const {
+    QVector<QString> paths;
+    for (QFileInfo const& drive : QDir::drives()) {
+        collectChecked(drive.absoluteFilePath(), false, paths);
     }
+    return paths;
 }
 
-void CustomModel::recheck() {
-    setData(index("/"), QVariant(), Qt::CheckStateRole);
+void CustomModel::collectChecked(QString const& path, bool inherited, QVector<QString> &paths) const {
+    bool checked = rules.value(path, inherited);
+    if (!rulesBelow.contains(path)) {
+        if (checked) {
+            paths.push_back(path);
+        }
+        return;
+    }
+    // only directories on the way to a rule are listed
+    QDir dir(path);
+    for (QString const& entry : dir.entryList(QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden)) {
+        collectChecked(dir.filePath(entry), checked, paths);
+    }
 }
 
 bool CustomModel::setData(const QModelIndex& index, const QVariant& value, int role) {
     if (lock) return false;
-    QString path = filePath(index);
     if (role == Qt::CheckStateRole) {
-        bool tmp;
-        int prevValue = checkedNumber[path];
-        if (prevValue == 0) {
-            tmp = true;
-            checkedNumber[path] = (rowCount(index) == 0? 1 : rowCount(index) * 2);
-        } else {
-            tmp = false;
-            checkedNumber[path] = 0;
-        }
-
-        setParentCheck(index, prevValue, checkedNumber[path]);
-
-        setChildrenCheck(index, tmp);
-
-        emit dataChanged(index, index);
+        setRule(filePath(index), isChecked(index) == Qt::Unchecked);
+        QModelIndex changed = collapseRules(index);
+        emitSubtreeChanged(changed);
+        emitAncestorsChanged(changed);
         return true;
     }
     return QFileSystemModel::setData(index, value, role);
@@ -2,7 +2,14 @@
 #define CUSTOMMODEL_H
 
 #include <QFileSystemModel>
-
+#include <QHash>
+#include <QSet>
+#include <QVector>
+
+// File system model with inherited check and mark state.
+// Only explicit include/exclude rules and marked roots are stored, the state of any
+// other node is taken from its nearest ancestor with a rule, so a toggle changes O(depth) state
+// and only the loaded part of the tree is notified.
 class CustomModel : public QFileSystemModel {
 public:
     CustomModel(QObject *parent);
@@ -13,27 +20,38 @@ public:
 
     void setMarked(QModelIndex const& index, bool mark);
 
-    void recheck();
+    void clearMarked();
 
     bool isMarked(QModelIndex const& index) const;
 
-    QMap<QString, bool> marked;
+    QVector<QString> checkedPaths() const;
 
-private slots:
+private:
+    QHash<QString, bool> rules;
+    QHash<QString, int> rulesBelow;
+    QSet<QString> marked;
 
-    void checkLoadedDirectory(QString const &path);
+    QVariant data(const QModelIndex& index, int role) const;
 
-private:
-    QMap<QString, int> checkedNumber;
+    bool inheritedCheck(QString const& path) const;
 
+    void setRule(QString const& path, bool check);
 
-    QVariant data(const QModelIndex& index, int role) const;
+    void removeRule(QString const& path);
+
+    void changeRulesBelow(QString const& path, int delta);
+
+    void collectChecked(QString const& path, bool inherited, QVector<QString> &paths) const;
+
+    QModelIndex collapseRules(QModelIndex index);
+
+    void emitSubtreeChanged(QModelIndex const& index);
 
-    void setChildrenMark(QModelIndex const& index, bool mark);
+    void emitChildrenChanged(QModelIndex const& parent);
 
-    void setChildrenCheck(QModelIndex const& index, bool check);
+    void emitAncestorsChanged(QModelIndex const& index);
 
-    void setParentCheck(QModelIndex const& index, int prevValue, int currValue);
+    static QString parentPath(QString const& path);
 
     Qt::ItemFlags flags(const QModelIndex& index) const;
 
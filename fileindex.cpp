@@ -1,11 +1,66 @@
 #include "fileindex.h"
 
-FileIndex::FileIndex(QString const& filePath) : QObject(), filePath(filePath) {
-
+FileIndex::FileIndex(QString const& filePath) : QObject(), contentHash(0), hashed(false) {
+    filePaths.push_back(filePath);
 }
 
 QString FileIndex::getFilePath() {
-    return filePath;
+    return filePaths.first();
+}
+
+QVector<QString> const& FileIndex::getFilePaths() const {
+    return filePaths;
+}
+
+void FileIndex::addFilePath(QString const& filePath) {
+    if (positions.isEmpty()) {
+        if (filePaths.contains(filePath)) {
+            return;
+        }
+        for (int i = 0; i < filePaths.size(); i++) {
+            positions.insert(filePaths[i], i);
+        }
+    } else if (positions.contains(filePath)) {
+        return;
+    }
+    positions.insert(filePath, filePaths.size());
+    filePaths.push_back(filePath);
+}
+
+int FileIndex::removeFilePath(QString const& filePath) {
+    if (positions.isEmpty()) {
+        filePaths.removeOne(filePath);
+        return filePaths.size();
+    }
+    auto it = positions.find(filePath);
+    if (it == positions.end()) {
+        return filePaths.size();
+    }
+    // the last path takes the place of the removed one
+    int position = *it;
+    positions.erase(it);
+    if (position != filePaths.size() - 1) {
+        filePaths[position] = filePaths.last();
+        positions[filePaths[position]] = position;
+    }
+    filePaths.removeLast();
+    if (filePaths.size() == 1) {
+        positions.clear();
+    }
+    return filePaths.size();
+}
+
+bool FileIndex::hasContentHash() const {
+    return hashed;
+}
+
+quint64 FileIndex::getContentHash() const {
+    return contentHash;
+}
+
+void FileIndex::setContentHash(quint64 hash) {
+    contentHash = hash;
+    hashed = true;
 }
 
 void FileIndex::insertTrg(uint32_t trg) {
@@ -20,6 +75,14 @@ bool FileIndex::containsTrg(uint32_t trg) {
     return trgs.contains(trg);
 }
 
+QSet<uint32_t> const& FileIndex::getTrgs() const {
+    return trgs;
+}
+
+void FileIndex::setTrgs(QSet<uint32_t> const& trgs) {
+    this->trgs = trgs;
+}
+
 size_t FileIndex::size() {
     return trgs.size();
 }
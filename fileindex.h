@@ -1,9 +1,12 @@
 #ifndef FILEINDEX_H
 #define FILEINDEX_H
 
+#include <QHash>
 #include <QObject>
 #include <QSet>
+#include <QVector>
 
+// Trigrams of one file content, shared by all paths with identical content.
 class FileIndex : public QObject {
     Q_OBJECT
 public:
@@ -11,13 +14,25 @@ public:
     ~FileIndex() = default;
 
     QString getFilePath();
+    QVector<QString> const& getFilePaths() const;
+    void addFilePath(QString const& filePath);
+    int removeFilePath(QString const& filePath);
+    bool hasContentHash() const;
+    quint64 getContentHash() const;
+    void setContentHash(quint64 hash);
     void insertTrg(uint32_t trg);
     void clearTrgs();
     bool containsTrg(uint32_t trg);
+    QSet<uint32_t> const& getTrgs() const;
+    void setTrgs(QSet<uint32_t> const& trgs);
     size_t size();
 private:
     QSet<uint32_t> trgs;
-    QString filePath;
+    QVector<QString> filePaths;
+    // position of every path once there are several, most contents have a single path
+    QHash<QString, int> positions;
+    quint64 contentHash;
+    bool hashed;
 signals:
 
 public slots:
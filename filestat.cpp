@@ -0,0 +1,52 @@
+#include "filestat.h"
+
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#endif
+
+bool FileStat::operator==(FileStat const& other) const {
+    return inode == other.inode && size == other.size && mtime == other.mtime;
+}
+
+bool FileStat::operator!=(FileStat const& other) const {
+    return !(*this == other);
+}
+
+bool FileStat::of(QString const& filePath, FileStat &stat) {
+#ifdef Q_OS_UNIX
+    struct stat st;
+    if (::stat(QFile::encodeName(filePath).constData(), &st) != 0) {
+        return false;
+    }
+    stat.inode = st.st_ino;
+    stat.size = st.st_size;
+#if defined(Q_OS_LINUX)
+    stat.mtime = qint64(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#elif defined(Q_OS_DARWIN)
+    stat.mtime = qint64(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    stat.mtime = qint64(st.st_mtime) * 1000000000;
+#endif
+#else
+    QFileInfo info(filePath);
+    if (!info.exists()) {
+        return false;
+    }
+    stat.inode = 0;
+    stat.size = info.size();
+    stat.mtime = info.lastModified().toMSecsSinceEpoch() * 1000000;
+#endif
+    return true;
+}
+
+QDataStream &operator<<(QDataStream &out, FileStat const& stat) {
+    return out << stat.inode << stat.size << stat.mtime;
+}
+
+QDataStream &operator>>(QDataStream &in, FileStat &stat) {
+    return in >> stat.inode >> stat.size >> stat.mtime;
+}
@@ -0,0 +1,22 @@
+#ifndef FILESTAT_H
+#define FILESTAT_H
+
+#include <QDataStream>
+#include <QString>
+
+// Identity of a file version taken from one stat call, kept in the shard manifest.
+struct FileStat {
+    quint64 inode;
+    qint64 size;
+    qint64 mtime;
+
+    bool operator==(FileStat const& other) const;
+    bool operator!=(FileStat const& other) const;
+
+    static bool of(QString const& filePath, FileStat &stat);
+};
+
+QDataStream &operator<<(QDataStream &out, FileStat const& stat);
+QDataStream &operator>>(QDataStream &in, FileStat &stat);
+
+#endif // FILESTAT_H
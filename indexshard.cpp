@@ -0,0 +1,514 @@
+#include "indexshard.h"
+#include "instrumentation.h"
+
+#include <QDataStream>
+#include <QFile>
+#include <QReadLocker>
+#include <QSaveFile>
+#include <QWriteLocker>
+#include <algorithm>
+
+IndexShard::IndexShard(int id, int shardCount, QString const& storagePath) : id(id), shardCount(shardCount), storagePath(storagePath), trgCount(0), spilled(false), dirty(false) {
+
+}
+
+IndexShard::~IndexShard() {
+    clear();
+}
+
+int IndexShard::getId() const {
+    return id;
+}
+
+int IndexShard::size() const {
+    QReadLocker locker(&lock);
+    return fileIndecies.size();
+}
+
+qint64 IndexShard::memoryUsage() const {
+    QReadLocker locker(&lock);
+    return trgCount * BYTES_PER_TRG + qint64(fileIndecies.size()) * BYTES_PER_PATH;
+}
+
+void IndexShard::insert(FileIndex *index) {
+    dirty = true;
+    contents.insert(index);
+    trgCount += index->size();
+    if (index->hasContentHash()) {
+        byContent.insert(index->getContentHash(), index);
+    }
+    for (QString const& filePath : index->getFilePaths()) {
+        fileIndecies.insert(filePath, index);
+    }
+}
+
+void IndexShard::detach(QString const& filePath) {
+    if (manifest.remove(filePath) > 0) {
+        dirty = true;
+    }
+    FileIndex *index = fileIndecies.take(filePath);
+    if (index == nullptr) {
+        return;
+    }
+    dirty = true;
+    if (index->removeFilePath(filePath) > 0) {
+        return;
+    }
+    contents.remove(index);
+    trgCount -= index->size();
+    if (index->hasContentHash() && byContent.value(index->getContentHash()) == index) {
+        byContent.remove(index->getContentHash());
+    }
+    delete index;
+}
+
+bool IndexShard::contains(QString const& filePath) const {
+    QReadLocker locker(&lock);
+    return fileIndecies.contains(filePath);
+}
+
+void IndexShard::addIndex(FileIndex *index) {
+    QWriteLocker locker(&lock);
+    restoreLocked();
+    for (QString const& filePath : index->getFilePaths()) {
+        detach(filePath);
+    }
+    insert(index);
+}
+
+void IndexShard::removeFile(QString const& filePath) {
+    QWriteLocker locker(&lock);
+    restoreLocked();
+    detach(filePath);
+}
+
+bool IndexShard::attachToContent(QString const& filePath, quint64 hash) {
+    QWriteLocker locker(&lock);
+    restoreLocked();
+    FileIndex *index = byContent.value(hash, nullptr);
+    if (index == nullptr) {
+        return false;
+    }
+    if (fileIndecies.value(filePath) != index) {
+        detach(filePath);
+        index->addFilePath(filePath);
+        fileIndecies.insert(filePath, index);
+        dirty = true;
+    }
+    return true;
+}
+
+FileIndex *IndexShard::takeFile(QString const& filePath, FileStat &stat) {
+    QWriteLocker locker(&lock);
+    restoreLocked();
+    FileIndex *index = fileIndecies.value(filePath, nullptr);
+    if (index == nullptr || index->getFilePaths().size() > 1) {
+        return nullptr;
+    }
+    dirty = true;
+    stat = manifest.take(filePath);
+    fileIndecies.remove(filePath);
+    contents.remove(index);
+    trgCount -= index->size();
+    if (index->hasContentHash() && byContent.value(index->getContentHash()) == index) {
+        byContent.remove(index->getContentHash());
+    }
+    return index;
+}
+
+QVector<FileIndex *> IndexShard::takeAll(QHash<QString, FileStat> &stats) {
+    QWriteLocker locker(&lock);
+    restoreLocked();
+    QVector<FileIndex *> indecies;
+    for (FileIndex *index : contents) {
+        indecies.push_back(index);
+    }
+    stats.unite(manifest);
+    contents.clear();
+    byContent.clear();
+    fileIndecies.clear();
+    manifest.clear();
+    trgCount = 0;
+    dirty = true;
+    return indecies;
+}
+
+void IndexShard::clear() {
+    QWriteLocker locker(&lock);
+    qDeleteAll(contents);
+    contents.clear();
+    byContent.clear();
+    fileIndecies.clear();
+    manifest.clear();
+    trgCount = 0;
+    spilled = false;
+}
+
+QList<QString> IndexShard::getFilePaths() const {
+    QReadLocker locker(&lock);
+    return fileIndecies.keys();
+}
+
+bool IndexShard::isUpToDate(QString const& filePath, FileStat const& stat) const {
+    QReadLocker locker(&lock);
+    auto it = manifest.find(filePath);
+    return it != manifest.end() && *it == stat;
+}
+
+void IndexShard::setFileStat(QString const& filePath, FileStat const& stat) {
+    QWriteLocker locker(&lock);
+    restoreLocked();
+    auto it = manifest.find(filePath);
+    if (it != manifest.end() && *it == stat) {
+        return;
+    }
+    if (fileIndecies.contains(filePath)) {
+        manifest.insert(filePath, stat);
+        dirty = true;
+    }
+}
+
+void IndexShard::collectSizes(QHash<QString, FileStat> const& changed, QHash<qint64, int> &counts,
+                              QHash<qint64, QVector<QString>> &unhashed) const {
+    QReadLocker locker(&lock);
+    for (auto it = manifest.begin(); it != manifest.end(); ++it) {
+        if (changed.contains(it.key())) {
+            continue;
+        }
+        counts[it->size]++;
+        FileIndex *index = fileIndecies.value(it.key(), nullptr);
+        if (index != nullptr && !index->hasContentHash()) {
+            unhashed[it->size].push_back(it.key());
+        }
+    }
+}
+
+bool containsTrgs(QVector<uint32_t> const& patternTrgs, FileIndex *index) {
+    for (uint32_t const& i : patternTrgs) {
+        if (!index->containsTrg(i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool IndexShard::fileContains(QString const& filePath, QString const& pattern,
+                              CancellationToken const& token) {
+    QFile file(filePath);
+    if (!file.open(QFile::ReadOnly)) {
+        return false;
+    }
+    QString line;
+    while (!file.atEnd()) {
+        if (token.isCanceled()) {
+            return false;
+        }
+        QByteArray bytes = file.read(1000);
+        Instrumentation::add(Instrumentation::VERIFIED_BYTES, bytes.size());
+        line += bytes;
+        if (line.indexOf(pattern) >= 0) {
+            return true;
+        }
+        line = line.mid(line.size()-pattern.size(), pattern.size());
+    }
+    return false;
+}
+
+QVector<QString> IndexShard::verify(QVector<QVector<QString>> const& matches, QString const& pattern,
+                                    CancellationToken const& token, QVector<QString> &candidates) {
+    ScopedTimer timer(Instrumentation::QUERY_VERIFY);
+    Instrumentation::add(Instrumentation::QUERY_CANDIDATES, matches.size());
+    QVector<QString> result;
+    for (QVector<QString> const& filePaths : matches) {
+        if (token.isCanceled()) {
+            break;
+        }
+        candidates += filePaths;
+        if (fileContains(filePaths.first(), pattern, token)) {
+            result += filePaths;
+        }
+    }
+    return result;
+}
+
+QVector<QString> IndexShard::search(QString const& pattern, QVector<uint32_t> const& patternTrgs,
+                                    CancellationToken const& token, QVector<QString> &candidates) const {
+    QReadLocker locker(&lock);
+    QVector<QVector<QString>> matches;
+    {
+        // one timer per scan, the filter step of a single file is too short to be worth an event
+        ScopedTimer timer(Instrumentation::QUERY_FILTER);
+        if (spilled) {
+            // queries stream a spilled shard from its file instead of bringing it back into memory
+            filterStored(nullptr, patternTrgs, token, matches);
+        } else {
+            for (FileIndex *index : contents) {
+                if (token.isCanceled()) {
+                    break;
+                }
+                if (containsTrgs(patternTrgs, index)) {
+                    matches.push_back(index->getFilePaths());
+                }
+            }
+        }
+    }
+    return verify(matches, pattern, token, candidates);
+}
+
+QVector<QString> IndexShard::searchWithin(QVector<QString> const& filePaths, QString const& pattern,
+                                          QVector<uint32_t> const& patternTrgs, CancellationToken const& token,
+                                          QVector<QString> &candidates) const {
+    QReadLocker locker(&lock);
+    QVector<QVector<QString>> matches;
+    {
+        ScopedTimer timer(Instrumentation::QUERY_FILTER);
+        if (spilled) {
+            QSet<QString> scope;
+            for (QString const& filePath : filePaths) {
+                scope.insert(filePath);
+            }
+            filterStored(&scope, patternTrgs, token, matches);
+        } else {
+            QSet<FileIndex *> checked;
+            for (QString const& filePath : filePaths) {
+                if (token.isCanceled()) {
+                    break;
+                }
+                FileIndex *index = fileIndecies.value(filePath, nullptr);
+                if (index != nullptr && !checked.contains(index)) {
+                    checked.insert(index);
+                    if (containsTrgs(patternTrgs, index)) {
+                        matches.push_back(index->getFilePaths());
+                    }
+                }
+            }
+        }
+    }
+    return verify(matches, pattern, token, candidates);
+}
+
+bool IndexShard::save() const {
+    QReadLocker locker(&lock);
+    return saveLocked();
+}
+
+bool IndexShard::saveLocked() const {
+    if (spilled || !dirty) {
+        // the shard file already holds this state, a spilled shard is always clean
+        return true;
+    }
+    QSaveFile file(storagePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    QDataStream out(&file);
+    out << MAGIC << VERSION << qint32(id) << qint32(shardCount) << qint32(contents.size())
+        << qint64(fileIndecies.size()) << trgCount;
+    for (FileIndex *index : contents) {
+        out << index->getFilePaths() << index->hasContentHash() << index->getContentHash() << index->getTrgs();
+    }
+    out << manifest;
+    if (out.status() != QDataStream::Ok || !file.commit()) {
+        return false;
+    }
+    dirty = false;
+    return true;
+}
+
+bool IndexShard::load(bool spill) {
+    QFile file(storagePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    QDataStream in(&file);
+    qint32 count;
+    if (!readHeader(in, count)) {
+        return false;
+    }
+    clear();
+    QWriteLocker locker(&lock);
+    for (int i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+        QVector<QString> filePaths;
+        bool hashed;
+        quint64 hash;
+        QSet<uint32_t> trgs;
+        in >> filePaths >> hashed >> hash >> trgs;
+        if (filePaths.isEmpty()) {
+            continue;
+        }
+        FileIndex *index = new FileIndex(filePaths.first());
+        for (QString const& filePath : filePaths) {
+            detach(filePath);
+            index->addFilePath(filePath);
+        }
+        if (hashed) {
+            index->setContentHash(hash);
+        }
+        if (!spill) {
+            index->setTrgs(trgs);
+        }
+        insert(index);
+    }
+    in >> manifest;
+    if (in.status() != QDataStream::Ok) {
+        qDeleteAll(contents);
+        contents.clear();
+        byContent.clear();
+        fileIndecies.clear();
+        manifest.clear();
+        trgCount = 0;
+        return false;
+    }
+    // the file was just read, so it holds exactly what a spilled shard keeps in memory
+    spilled = spill;
+    dirty = false;
+    return true;
+}
+
+bool IndexShard::readMemoryUsage(qint64 &spilledUsage, qint64 &residentUsage) const {
+    QFile file(storagePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    QDataStream in(&file);
+    qint32 count;
+    qint64 pathCount, storedTrgCount;
+    if (!readHeader(in, count, &pathCount, &storedTrgCount)) {
+        return false;
+    }
+    spilledUsage = pathCount * BYTES_PER_PATH;
+    residentUsage = spilledUsage + storedTrgCount * BYTES_PER_TRG;
+    return true;
+}
+
+bool IndexShard::spill() {
+    QWriteLocker locker(&lock);
+    if (spilled || !saveLocked()) {
+        return false;
+    }
+    for (FileIndex *index : contents) {
+        index->clearTrgs();
+    }
+    trgCount = 0;
+    spilled = true;
+    return true;
+}
+
+void IndexShard::markDirty() {
+    dirty = true;
+}
+
+bool IndexShard::isDirty() const {
+    return dirty;
+}
+
+bool IndexShard::isSpilled() const {
+    return spilled;
+}
+
+bool IndexShard::restoreLocked() {
+    if (!spilled) {
+        return true;
+    }
+    spilled = false;
+    // the shard is unchanged since the spill, so every record still has its FileIndex
+    QFile file(storagePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        // trigrams are lost, forget the stat data so the next watch reads the files again
+        manifest.clear();
+        dirty = true;
+        return false;
+    }
+    QDataStream in(&file);
+    qint32 count;
+    if (!readHeader(in, count)) {
+        manifest.clear();
+        dirty = true;
+        return false;
+    }
+    for (int i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+        QVector<QString> filePaths;
+        bool hashed;
+        quint64 hash;
+        QSet<uint32_t> trgs;
+        in >> filePaths >> hashed >> hash >> trgs;
+        FileIndex *index = filePaths.isEmpty() ? nullptr : fileIndecies.value(filePaths.first(), nullptr);
+        if (index != nullptr) {
+            index->setTrgs(trgs);
+            trgCount += index->size();
+        }
+    }
+    if (in.status() != QDataStream::Ok) {
+        manifest.clear();
+        dirty = true;
+        return false;
+    }
+    return true;
+}
+
+bool IndexShard::readHeader(QDataStream &in, qint32 &count, qint64 *pathCount, qint64 *storedTrgCount) const {
+    quint32 magic, version;
+    qint32 shardId, storedShardCount;
+    qint64 paths, trgs;
+    in >> magic >> version >> shardId >> storedShardCount >> count >> paths >> trgs;
+    if (pathCount != nullptr) {
+        *pathCount = paths;
+    }
+    if (storedTrgCount != nullptr) {
+        *storedTrgCount = trgs;
+    }
+    return in.status() == QDataStream::Ok && magic == MAGIC && version == VERSION && shardId == id
+            && storedShardCount == shardCount;
+}
+
+int IndexShard::readShardCount(QString const& storagePath) {
+    QFile file(storagePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return -1;
+    }
+    QDataStream in(&file);
+    quint32 magic, version;
+    qint32 shardId, shardCount;
+    in >> magic >> version >> shardId >> shardCount;
+    if (in.status() != QDataStream::Ok || magic != MAGIC || version != VERSION) {
+        return -1;
+    }
+    return shardCount;
+}
+
+void IndexShard::filterStored(QSet<QString> const* scope, QVector<uint32_t> const& patternTrgs,
+                              CancellationToken const& token, QVector<QVector<QString>> &matches) const {
+    // a spilled shard is clean, so its file holds exactly the files in memory
+    QFile file(storagePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+    QDataStream in(&file);
+    qint32 count;
+    if (!readHeader(in, count)) {
+        return;
+    }
+    for (int i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+        if (token.isCanceled()) {
+            return;
+        }
+        QVector<QString> filePaths;
+        bool hashed;
+        quint64 hash;
+        QSet<uint32_t> trgs;
+        in >> filePaths >> hashed >> hash >> trgs;
+        if (filePaths.isEmpty()) {
+            continue;
+        }
+        if (scope != nullptr && std::none_of(filePaths.begin(), filePaths.end(), [scope](QString const& filePath) {
+            return scope->contains(filePath);
+        })) {
+            continue;
+        }
+        if (std::all_of(patternTrgs.begin(), patternTrgs.end(), [&trgs](uint32_t trg) {
+            return trgs.contains(trg);
+        })) {
+            matches.push_back(filePaths);
+        }
+    }
+}
@@ -0,0 +1,95 @@
+#ifndef INDEXSHARD_H
+#define INDEXSHARD_H
+
+#include "cancellationtoken.h"
+#include "fileindex.h"
+#include "filestat.h"
+
+#include <QDataStream>
+#include <QHash>
+#include <QList>
+#include <QReadWriteLock>
+#include <QSet>
+#include <QString>
+#include <QVector>
+#include <atomic>
+
+// Independent part of the index. Every file belongs to exactly one shard,
+// so shards can be built, saved, updated and queried in parallel.
+// A shard file records the shard count it was written for and is ignored under any other.
+// Files with identical content share one FileIndex, the Searcher keeps hashed files
+// in the shard of their content hash so that every copy meets in the same shard.
+// The manifest keeps the stat data of every indexed path to skip unchanged files,
+// and only shards changed since their last save are written again.
+// A saved shard can be spilled: its trigrams are dropped from memory, queries stream
+// them from the shard file and the next change reads them back. A shard can also be
+// loaded spilled, the header of its file tells how much memory it takes either way.
+class IndexShard {
+public:
+    IndexShard(int id, int shardCount, QString const& storagePath);
+    ~IndexShard();
+
+    int getId() const;
+    int size() const;
+    qint64 memoryUsage() const;
+
+    bool contains(QString const& filePath) const;
+    void addIndex(FileIndex *index);
+    void removeFile(QString const& filePath);
+    bool attachToContent(QString const& filePath, quint64 hash);
+    FileIndex *takeFile(QString const& filePath, FileStat &stat);
+    QVector<FileIndex *> takeAll(QHash<QString, FileStat> &stats);
+    void clear();
+    QList<QString> getFilePaths() const;
+
+    bool isUpToDate(QString const& filePath, FileStat const& stat) const;
+    void setFileStat(QString const& filePath, FileStat const& stat);
+    void collectSizes(QHash<QString, FileStat> const& changed, QHash<qint64, int> &counts,
+                      QHash<qint64, QVector<QString>> &unhashed) const;
+
+    QVector<QString> search(QString const& pattern, QVector<uint32_t> const& patternTrgs,
+                            CancellationToken const& token, QVector<QString> &candidates) const;
+    QVector<QString> searchWithin(QVector<QString> const& filePaths, QString const& pattern,
+                                  QVector<uint32_t> const& patternTrgs, CancellationToken const& token,
+                                  QVector<QString> &candidates) const;
+
+    bool save() const;
+    bool load(bool spill);
+    bool readMemoryUsage(qint64 &spilledUsage, qint64 &residentUsage) const;
+    bool spill();
+    bool isSpilled() const;
+    bool isDirty() const;
+    void markDirty();
+
+    static int readShardCount(QString const& storagePath);
+private:
+    bool saveLocked() const;
+    bool restoreLocked();
+    bool readHeader(QDataStream &in, qint32 &count, qint64 *pathCount = nullptr, qint64 *storedTrgCount = nullptr) const;
+    void filterStored(QSet<QString> const* scope, QVector<uint32_t> const& patternTrgs,
+                      CancellationToken const& token, QVector<QVector<QString>> &matches) const;
+    void detach(QString const& filePath);
+    void insert(FileIndex *index);
+    static QVector<QString> verify(QVector<QVector<QString>> const& matches, QString const& pattern,
+                                   CancellationToken const& token, QVector<QString> &candidates);
+    static bool fileContains(QString const& filePath, QString const& pattern,
+                             CancellationToken const& token);
+    static const quint32 MAGIC = 0x70667368,
+                         VERSION = 6;
+    static const int BYTES_PER_TRG = 16,
+                     BYTES_PER_PATH = 128;
+
+    int id, shardCount;
+    QString storagePath;
+    qint64 trgCount;
+    std::atomic<bool> spilled;
+    // set by every change, cleared once the shard file holds the current state
+    mutable std::atomic<bool> dirty;
+    QHash<QString, FileIndex *> fileIndecies;
+    QSet<FileIndex *> contents;
+    QHash<quint64, FileIndex *> byContent;
+    QHash<QString, FileStat> manifest;
+    mutable QReadWriteLock lock;
+};
+
+#endif // INDEXSHARD_H
@@ -0,0 +1,285 @@
+#include "instrumentation.h"
+
+#include <QFile>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QSet>
+#include <QTextStream>
+#include <QVector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+namespace {
+
+const char *COUNTER_NAMES[Instrumentation::COUNTER_COUNT] = {
+    "files_traversed", "files_indexed", "bytes_read", "files_hashed", "watched_paths",
+    "queries", "query_cache_hits", "query_candidates", "verified_bytes"
+};
+
+const char *STAGE_NAMES[Instrumentation::STAGE_COUNT] = {
+    "traversal", "stat", "hash", "index_file", "file_read", "decode", "tokenize", "watch",
+    "query", "query_filter", "query_verify"
+};
+
+const int BUCKET_COUNT = 64,
+          MAX_TRACE_EVENTS = 1 << 20;
+
+// durations are in nanoseconds, bucket i holds durations below 2^i
+struct Histogram {
+    std::atomic<quint64> buckets[BUCKET_COUNT];
+    std::atomic<quint64> count, total, max;
+};
+
+struct TraceEvent {
+    int thread;
+    int stage;
+    qint64 start, duration;
+};
+
+struct ThreadStats {
+    int id;
+    std::atomic<quint64> counters[Instrumentation::COUNTER_COUNT];
+    Histogram histograms[Instrumentation::STAGE_COUNT];
+    QMutex eventsMutex;
+    QVector<TraceEvent> events;
+    quint64 droppedEvents;
+};
+
+std::atomic<bool> enabled(false), tracing(false);
+// events kept by all threads together, so the trace has one memory ceiling however many threads run
+std::atomic<qint64> traceEvents(0);
+QMutex registryMutex;
+QVector<ThreadStats *> registry;
+int nextThreadId = 1;
+// zero initialized, it holds everything recorded by threads that already exited
+ThreadStats expired;
+const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+void retire(ThreadStats *stats) {
+    QMutexLocker locker(&registryMutex);
+    registry.removeOne(stats);
+    for (int i = 0; i < Instrumentation::COUNTER_COUNT; i++) {
+        expired.counters[i] += stats->counters[i].load(std::memory_order_relaxed);
+    }
+    for (int i = 0; i < Instrumentation::STAGE_COUNT; i++) {
+        Histogram &from = stats->histograms[i], &to = expired.histograms[i];
+        for (int j = 0; j < BUCKET_COUNT; j++) {
+            to.buckets[j] += from.buckets[j].load(std::memory_order_relaxed);
+        }
+        to.count += from.count.load(std::memory_order_relaxed);
+        to.total += from.total.load(std::memory_order_relaxed);
+        to.max = std::max(to.max.load(std::memory_order_relaxed), from.max.load(std::memory_order_relaxed));
+    }
+    // the events were counted when they were recorded
+    QMutexLocker eventsLocker(&expired.eventsMutex);
+    expired.events += stats->events;
+    expired.droppedEvents += stats->droppedEvents;
+    delete stats;
+}
+
+// pool threads expire and are created again, the slot of a thread lives as long as the thread
+struct ThreadSlot {
+    ThreadStats *stats = nullptr;
+
+    ~ThreadSlot() {
+        if (stats != nullptr) {
+            retire(stats);
+        }
+    }
+};
+
+thread_local ThreadSlot threadSlot;
+
+ThreadStats *currentThreadStats() {
+    ThreadStats *&threadStats = threadSlot.stats;
+    if (threadStats == nullptr) {
+        threadStats = new ThreadStats();
+        for (auto &counter : threadStats->counters) {
+            counter = 0;
+        }
+        for (auto &histogram : threadStats->histograms) {
+            for (auto &bucket : histogram.buckets) {
+                bucket = 0;
+            }
+            histogram.count = 0;
+            histogram.total = 0;
+            histogram.max = 0;
+        }
+        threadStats->droppedEvents = 0;
+        QMutexLocker locker(&registryMutex);
+        threadStats->id = nextThreadId++;
+        registry.push_back(threadStats);
+    }
+    return threadStats;
+}
+
+int bucketOf(quint64 duration) {
+    int bucket = 0;
+    while (bucket + 1 < BUCKET_COUNT && (quint64(1) << bucket) <= duration) {
+        bucket++;
+    }
+    return bucket;
+}
+
+QString formatDuration(quint64 nanoseconds) {
+    if (nanoseconds < 10000) {
+        return QString("%1ns").arg(nanoseconds);
+    }
+    if (nanoseconds < 10000000) {
+        return QString("%1us").arg(nanoseconds / 1000);
+    }
+    return QString("%1ms").arg(nanoseconds / 1000000);
+}
+
+}
+
+void Instrumentation::setEnabled(bool value) {
+    enabled.store(value, std::memory_order_relaxed);
+}
+
+bool Instrumentation::isEnabled() {
+    return enabled.load(std::memory_order_relaxed);
+}
+
+void Instrumentation::setTracing(bool value) {
+    tracing.store(value, std::memory_order_relaxed);
+}
+
+bool Instrumentation::isTracing() {
+    return tracing.load(std::memory_order_relaxed);
+}
+
+qint64 Instrumentation::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+void Instrumentation::add(Counter counter, quint64 value) {
+    if (!isEnabled()) {
+        return;
+    }
+    currentThreadStats()->counters[counter].fetch_add(value, std::memory_order_relaxed);
+}
+
+void Instrumentation::record(Stage stage, qint64 start, qint64 duration) {
+    if (!isEnabled()) {
+        return;
+    }
+    ThreadStats *stats = currentThreadStats();
+    Histogram &histogram = stats->histograms[stage];
+    histogram.buckets[bucketOf(duration)].fetch_add(1, std::memory_order_relaxed);
+    histogram.count.fetch_add(1, std::memory_order_relaxed);
+    histogram.total.fetch_add(duration, std::memory_order_relaxed);
+    if (quint64(duration) > histogram.max.load(std::memory_order_relaxed)) {
+        histogram.max.store(duration, std::memory_order_relaxed);
+    }
+    if (isTracing()) {
+        bool kept = traceEvents.load(std::memory_order_relaxed) < MAX_TRACE_EVENTS
+                && traceEvents.fetch_add(1, std::memory_order_relaxed) < MAX_TRACE_EVENTS;
+        QMutexLocker locker(&stats->eventsMutex);
+        if (kept) {
+            stats->events.push_back({stats->id, stage, start, duration});
+        } else {
+            stats->droppedEvents++;
+        }
+    }
+}
+
+QString Instrumentation::report() {
+    quint64 counters[COUNTER_COUNT] = {};
+    quint64 buckets[STAGE_COUNT][BUCKET_COUNT] = {};
+    quint64 count[STAGE_COUNT] = {}, total[STAGE_COUNT] = {}, max[STAGE_COUNT] = {};
+    {
+        QMutexLocker locker(&registryMutex);
+        QVector<ThreadStats *> all = registry;
+        all.push_back(&expired);
+        for (ThreadStats *stats : all) {
+            for (int i = 0; i < COUNTER_COUNT; i++) {
+                counters[i] += stats->counters[i].load(std::memory_order_relaxed);
+            }
+            for (int i = 0; i < STAGE_COUNT; i++) {
+                Histogram const& histogram = stats->histograms[i];
+                for (int j = 0; j < BUCKET_COUNT; j++) {
+                    buckets[i][j] += histogram.buckets[j].load(std::memory_order_relaxed);
+                }
+                count[i] += histogram.count.load(std::memory_order_relaxed);
+                total[i] += histogram.total.load(std::memory_order_relaxed);
+                max[i] = std::max(max[i], histogram.max.load(std::memory_order_relaxed));
+            }
+        }
+    }
+    QString result;
+    QTextStream out(&result);
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        out << COUNTER_NAMES[i] << ' ' << counters[i] << '\n';
+    }
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        if (count[i] == 0) {
+            continue;
+        }
+        // percentiles are reported as the upper bound of their bucket
+        quint64 percentiles[3] = {}, seen = 0;
+        double const ranks[3] = {0.5, 0.9, 0.99};
+        for (int j = 0, p = 0; j < BUCKET_COUNT && p < 3; j++) {
+            seen += buckets[i][j];
+            while (p < 3 && seen >= ranks[p] * count[i]) {
+                percentiles[p++] = quint64(1) << j;
+            }
+        }
+        out << STAGE_NAMES[i] << " count=" << count[i]
+            << " total=" << formatDuration(total[i])
+            << " p50<=" << formatDuration(percentiles[0])
+            << " p90<=" << formatDuration(percentiles[1])
+            << " p99<=" << formatDuration(percentiles[2])
+            << " max=" << formatDuration(max[i]) << '\n';
+    }
+    out.flush();
+    return result;
+}
+
+bool Instrumentation::exportTrace(QString const& path) {
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        return false;
+    }
+    QTextStream out(&file);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    QSet<int> named;
+    QMutexLocker locker(&registryMutex);
+    QVector<ThreadStats *> all = registry;
+    all.push_back(&expired);
+    for (ThreadStats *stats : all) {
+        QMutexLocker eventsLocker(&stats->eventsMutex);
+        for (TraceEvent const& event : stats->events) {
+            if (!named.contains(event.thread)) {
+                named.insert(event.thread);
+                out << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << event.thread
+                    << ",\"args\":{\"name\":\"thread " << event.thread << "\"}}";
+                first = false;
+            }
+            out << ",\n{\"name\":\"" << STAGE_NAMES[event.stage] << "\",\"cat\":\"pattern_finder\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+                << event.thread << ",\"ts\":" << QString::number(event.start / 1000.0, 'f', 3)
+                << ",\"dur\":" << QString::number(event.duration / 1000.0, 'f', 3) << '}';
+        }
+        if (stats->droppedEvents > 0) {
+            out << (first ? "" : ",") << "\n{\"name\":\"dropped_events\",\"ph\":\"C\",\"pid\":1,\"tid\":" << stats->id
+                << ",\"ts\":0,\"args\":{\"dropped\":" << stats->droppedEvents << "}}";
+            first = false;
+        }
+    }
+    out << "\n]}\n";
+    out.flush();
+    return file.commit();
+}
+
+ScopedTimer::ScopedTimer(Instrumentation::Stage stage) : stage(stage), start(Instrumentation::isEnabled() ? Instrumentation::now() : -1) {
+
+}
+
+ScopedTimer::~ScopedTimer() {
+    if (start >= 0) {
+        Instrumentation::record(stage, start, Instrumentation::now() - start);
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+#include <QString>
+
+// Process wide counters, per stage latency histograms and an optional trace.
+// Every thread writes into its own slot, slots are only summed up by report().
+// When a thread exits its slot is merged into one slot shared by all expired threads.
+// When instrumentation is disabled every call costs one relaxed atomic load.
+class Instrumentation {
+public:
+    enum Counter {
+        FILES_TRAVERSED,
+        FILES_INDEXED,
+        BYTES_READ,
+        FILES_HASHED,
+        WATCHED_PATHS,
+        QUERIES,
+        QUERY_CACHE_HITS,
+        QUERY_CANDIDATES,
+        VERIFIED_BYTES,
+        COUNTER_COUNT
+    };
+
+    enum Stage {
+        TRAVERSAL,
+        STAT,
+        HASH,
+        INDEX_FILE,
+        FILE_READ,
+        DECODE,
+        TOKENIZE,
+        WATCH,
+        QUERY,
+        QUERY_FILTER,
+        QUERY_VERIFY,
+        STAGE_COUNT
+    };
+
+    static void setEnabled(bool enabled);
+    static bool isEnabled();
+    static void setTracing(bool tracing);
+    static bool isTracing();
+
+    static void add(Counter counter, quint64 value = 1);
+    static void record(Stage stage, qint64 start, qint64 duration);
+    static qint64 now();
+
+    static QString report();
+    static bool exportTrace(QString const& path);
+};
+
+class ScopedTimer {
+public:
+    ScopedTimer(Instrumentation::Stage stage);
+    ~ScopedTimer();
+private:
+    Instrumentation::Stage stage;
+    qint64 start;
+};
+
+#endif // INSTRUMENTATION_H
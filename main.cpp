@@ -1,11 +1,45 @@
+#include "instrumentation.h"
 #include "mainwindow.h"
+#include "resourcegovernor.h"
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QTextStream>
 
 int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
-    mainWindow w;
-    w.show();
 
-    return a.exec();
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption statsOption("stats", "Collect indexing and query statistics and print them on exit.");
+    QCommandLineOption traceOption("trace", "Record stage timings and write them as Chrome trace JSON to <file> on exit.", "file");
+    QCommandLineOption memoryOption("memory-budget", "Keep at most <MiB> of index in memory, spill the rest to disk.", "MiB");
+    QCommandLineOption bandwidthOption("io-bandwidth", "Limit background indexing reads to <MiB> per second.", "MiB");
+    QCommandLineOption iopsOption("iops", "Limit background indexing to <count> file opens per second.", "count");
+    parser.addOption(statsOption);
+    parser.addOption(traceOption);
+    parser.addOption(memoryOption);
+    parser.addOption(bandwidthOption);
+    parser.addOption(iopsOption);
+    parser.process(a);
+
+    Instrumentation::setEnabled(parser.isSet(statsOption) || parser.isSet(traceOption));
+    Instrumentation::setTracing(parser.isSet(traceOption));
+    ResourceGovernor::setMemoryBudget(parser.value(memoryOption).toLongLong() << 20);
+    ResourceGovernor::setIoLimits(parser.value(bandwidthOption).toLongLong() << 20, parser.value(iopsOption).toInt());
+
+    int result;
+    {
+        mainWindow w;
+        w.show();
+        result = a.exec();
+    }
+
+    if (parser.isSet(statsOption)) {
+        QTextStream(stderr) << Instrumentation::report();
+    }
+    if (parser.isSet(traceOption) && !Instrumentation::exportTrace(parser.value(traceOption))) {
+        QTextStream(stderr) << "can't write trace to " << parser.value(traceOption) << '\n';
+    }
+    return result;
 }
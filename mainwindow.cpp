@@ -20,7 +20,7 @@
 #include <QPainter>
 #include <QtConcurrent/QtConcurrent>
 
-mainWindow::mainWindow(QWidget *parent):  QMainWindow(parent), searcher(nullptr), ui(new Ui::MainWindow) {
+mainWindow::mainWindow(QWidget *parent):  QMainWindow(parent), searcher(nullptr), currentQuery(0), watching(false), ui(new Ui::MainWindow) {
     ui->setupUi(this);
     setGeometry(QStyle::alignedRect(Qt::LeftToRight, Qt::AlignCenter, size(), qApp->desktop()->availableGeometry()));
 
@@ -59,6 +59,7 @@ mainWindow::mainWindow(QWidget *parent):  QMainWindow(parent), searcher(nullptr)
     connect(ui->listWidget, &QListWidget::customContextMenuRequested, this, &mainWindow::openItemMenu);
     connect(ui->watchButton, &QPushButton::clicked, this, &mainWindow::watch);
     connect(ui->searchButton, &QPushButton::clicked, this, &mainWindow::search);
+    connect(ui->patternEdit, &QLineEdit::textEdited, this, &mainWindow::liveSearch);
     connect(ui->cancelSearchButton, &QPushButton::clicked, this, &mainWindow::cancelSearch);
     connect(ui->cancelWatchButton, &QPushButton::clicked, this, &mainWindow::cancelWatch);
     connect(ui->listWidget, &QListWidget::itemDoubleClicked, this, &mainWindow::showFile);
@@ -71,45 +72,31 @@ mainWindow::~mainWindow() {
     if (searcher!=nullptr) {
         cancelWatch();
         cancelSearch();
-        searchWatcher.waitForFinished();
         watchWatcher.waitForFinished();
     }
     delete dirModel;
 }
 
-void mainWindow::modelToVector(QModelIndex const &index, QVector<QString> &files) {
-    QString path = dirModel->filePath(index);
-    if (dirModel->isChecked(index) == Qt::Checked) {
-        files.push_back(path);
-    } else if (dirModel->isChecked(index) == Qt::PartiallyChecked) {
-        for (int i = 0; i < dirModel->rowCount(index); i++) {
-            modelToVector(dirModel->index(i, 0, index), files);
-        }
-    }
-}
-
 void mainWindow::watch() {
     ui->listWidget->clear();
     blockWatch();
-    QVector<QString> files;
-    modelToVector(dirModel->index(dirModel->rootPath(),0), files);
-    searcher.reset(new Searcher(nullptr, files));
-    connect(searcher.get(), &Searcher::requestReindex, this, &mainWindow::requestReindex);
+    QVector<QString> files = dirModel->checkedPaths();
+    ++currentQuery;
+    if (searcher == nullptr) {
+        searcher.reset(new Searcher(nullptr, files));
+        connect(searcher.get(), &Searcher::itemAdded, this, &mainWindow::addItem);
+        connect(searcher.get(), &Searcher::searchFinished, this, &mainWindow::searchFinished);
+    } else {
+        searcher->cancelSearch();
+        searcher->files = files;
+    }
     connect(searcher.get(), &Searcher::progressBarChanged, this, &mainWindow::setProgressBar);
     connect(searcher.get(), &Searcher::finished, this, &mainWindow::unblockWatch);
     watchWatcher.setFuture(QtConcurrent::run(searcher.get(), &Searcher::process));
 }
 
-void mainWindow::requestReindex() {
-    dirModel->recheck();
-    QMessageBox::StandardButton alert;
-    alert = QMessageBox::information(this,"You should reindex files","Some files have been changed.", QMessageBox::Ok);
-    if (alert == QMessageBox::Ok) {
-        return;
-    }
-}
-
 void mainWindow::blockWatch() {
+    watching = true;
     setProgressBar(0);
     ui->showPatternLines->hide();
     ui->searchButton->setDisabled(true);
@@ -117,7 +104,7 @@ void mainWindow::blockWatch() {
     ui->watchButton->hide();
     ui->progressBar->show();
     dirModel->setLock(true);
-    dirModel->marked.clear();
+    dirModel->clearMarked();
 }
 
 void mainWindow::unblockWatch() {
@@ -133,6 +120,11 @@ void mainWindow::unblockWatch() {
     }
     disconnect(searcher.get(), &Searcher::progressBarChanged, this, &mainWindow::setProgressBar);
     disconnect(searcher.get(), &Searcher::finished, this, &mainWindow::unblockWatch);
+    watching = false;
+    // the pattern may have been edited while the index was built
+    if (!ui->patternEdit->text().isEmpty()) {
+        liveSearch(ui->patternEdit->text());
+    }
 }
 
 void mainWindow::search() {
@@ -147,13 +139,31 @@ void mainWindow::search() {
         }
     }
     blockSearch();
-    QVector<QString> files;
-    modelToVector(dirModel->index(dirModel->rootPath(),0), files);
-    searcher->setPattern(patternString);
     connect(searcher.get(), &Searcher::progressBarChanged, this, &mainWindow::setProgressBar);
-    connect(searcher.get(), &Searcher::finished, this, &mainWindow::unblockSearch);
-    connect(searcher.get(), &Searcher::itemAdded, this, &mainWindow::addItem);
-    searchWatcher.setFuture(QtConcurrent::run(searcher.get(), &Searcher::search));
+    searcher->startSearch(patternString, ++currentQuery);
+}
+
+void mainWindow::liveSearch(QString const& text) {
+    // edits made during a watch are searched when it finishes
+    if (searcher == nullptr || watching) {
+        return;
+    }
+    ui->listWidget->clear();
+    ui->showPatternLines->hide();
+    patternString = text;
+    ++currentQuery;
+    if (patternString.size() < 3 || patternString.size() > 1000) {
+        searcher->cancelSearch();
+        unblockSearch();
+        return;
+    }
+    searcher->startSearch(patternString, currentQuery);
+}
+
+void mainWindow::searchFinished(quint64 queryId) {
+    if (queryId == currentQuery) {
+        unblockSearch();
+    }
 }
 
 void mainWindow::blockSearch() {
@@ -174,16 +184,16 @@ void mainWindow::unblockSearch() {
     ui->progressBar->hide();
     dirModel->setLock(false);
     disconnect(searcher.get(), &Searcher::progressBarChanged, this, &mainWindow::setProgressBar);
-    disconnect(searcher.get(), &Searcher::finished, this, &mainWindow::unblockSearch);
-    disconnect(searcher.get(), &Searcher::itemAdded, this, &mainWindow::addItem);
 }
 
-void mainWindow::addItem(QString filePath) {
-    ui->listWidget->addItem(filePath);
+void mainWindow::addItem(quint64 queryId, QString filePath) {
+    if (queryId == currentQuery) {
+        ui->listWidget->addItem(filePath);
+    }
 }
 
 void mainWindow::cancelSearch() {
-    searcher->cancel();
+    searcher->cancelSearch();
 }
 
 void mainWindow::cancelWatch() {
@@ -25,7 +25,6 @@ public:
     ~mainWindow();
 
 private slots:
-    void requestReindex();
     void show_about_dialog();
     void openItem();
     void openItemMenu(const QPoint &pos);
@@ -33,6 +32,8 @@ private slots:
     void clearClickedItem();
     void watch();
     void search();
+    void liveSearch(QString const& text);
+    void searchFinished(quint64 queryId);
     void cancelWatch();
     void cancelSearch();
     void showFile(QListWidgetItem *item);
@@ -40,14 +41,15 @@ private slots:
     void unblockWatch();
     void blockSearch();
     void unblockSearch();
-    void modelToVector(QModelIndex const &index, QVector<QString> &files);
 public slots:
     void addScannedFiles(QVector<QList<QString>> files);
     void setProgressBar(int progress);
-    void addItem(QString filePath);
+    void addItem(quint64 queryId, QString filePath);
 private:
     std::unique_ptr<Searcher> searcher;
-    QFutureWatcher<void> searchWatcher, watchWatcher;
+    QFutureWatcher<void> watchWatcher;
+    quint64 currentQuery;
+    bool watching;
     QString patternString;
     QListWidgetItem *clickedItem;
     CustomModel *dirModel;
@@ -28,13 +28,27 @@ SOURCES += \
         main.cpp \
         mainwindow.cpp \
         custommodel.cpp \
+    cancellationtoken.cpp \
+    contenthash.cpp \
     fileindex.cpp \
+    filestat.cpp \
+    indexshard.cpp \
+    instrumentation.cpp \
+    querycache.cpp \
+    resourcegovernor.cpp \
     searcher.cpp
 
 HEADERS += \
         mainwindow.h \
         custommodel.h \
+    cancellationtoken.h \
+    contenthash.h \
     fileindex.h \
+    filestat.h \
+    indexshard.h \
+    instrumentation.h \
+    querycache.h \
+    resourcegovernor.h \
     searcher.h
 
 FORMS += \
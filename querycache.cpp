@@ -0,0 +1,166 @@
+#include "querycache.h"
+
+#include <QMutexLocker>
+
+QueryCache::QueryCache(int maxCost) : maxCost(maxCost), totalCost(0), generation(0), sequence(0) {
+
+}
+
+int QueryCache::cost(Entry const& entry) {
+    return entry.candidates.size() + entry.results.size() + entry.dirty.size() + 1;
+}
+
+void QueryCache::touch(QString const& pattern) {
+    recent.removeOne(pattern);
+    recent.push_front(pattern);
+}
+
+void QueryCache::evict() {
+    while (totalCost > maxCost && !recent.isEmpty()) {
+        totalCost -= cost(entries.take(recent.takeLast()));
+    }
+}
+
+bool QueryCache::find(QString const& pattern, quint64 generation, QSet<QString> &candidates, QSet<QString> &results,
+                      QSet<QString> &dirty, bool &complete) {
+    QMutexLocker locker(&mutex);
+    if (generation != this->generation) {
+        return false;
+    }
+    auto it = entries.find(pattern);
+    if (it == entries.end() || !it->unscanned.isEmpty()) {
+        return false;
+    }
+    touch(pattern);
+    candidates = it->candidates;
+    results = it->results;
+    dirty = it->dirty;
+    complete = it->complete;
+    return true;
+}
+
+bool QueryCache::findSuperset(QString const& pattern, QVector<uint32_t> const& patternTrgs, quint64 generation,
+                              QSet<QString> &superset, QSet<int> &unscanned, bool &complete) {
+    QMutexLocker locker(&mutex);
+    if (generation != this->generation) {
+        return false;
+    }
+    QSet<uint32_t> trgs;
+    for (uint32_t trg : patternTrgs) {
+        trgs.insert(trg);
+    }
+    QString best;
+    QSet<QString> const* bestSet = nullptr;
+    int bestSize = 0, bestUnscanned = 0;
+    bool bestComplete = false;
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        QSet<QString> const* set;
+        bool fromCandidates;
+        if (pattern.contains(it.key())) {
+            // every file containing the pattern contains the cached one
+            set = &it->results;
+            fromCandidates = false;
+        } else if (it->complete && trgs.contains(it->trgs)) {
+            set = &it->candidates;
+            fromCandidates = true;
+        } else {
+            continue;
+        }
+        // every unscanned shard is searched in full, so fewer of them beats a smaller set
+        int unscannedCount = it->unscanned.size(), size = set->size() + it->dirty.size();
+        if (bestSet == nullptr || unscannedCount < bestUnscanned
+                || (unscannedCount == bestUnscanned && size < bestSize)) {
+            best = it.key();
+            bestSet = set;
+            bestSize = size;
+            bestUnscanned = unscannedCount;
+            bestComplete = fromCandidates;
+        }
+    }
+    if (bestSet == nullptr) {
+        return false;
+    }
+    touch(best);
+    superset = *bestSet;
+    superset.unite(entries[best].dirty);
+    unscanned = entries[best].unscanned;
+    complete = bestComplete;
+    return true;
+}
+
+void QueryCache::insert(QString const& pattern, QVector<uint32_t> const& patternTrgs, quint64 generation,
+                        QSet<QString> const& candidates, QSet<QString> const& results, bool complete,
+                        QSet<int> const& unscanned, quint64 sequence) {
+    QMutexLocker locker(&mutex);
+    if (generation < this->generation) {
+        return;
+    }
+    if (this->sequence - sequence > quint64(invalidated.size())) {
+        // too many files changed during the query to tell which of them it missed
+        return;
+    }
+    if (generation > this->generation) {
+        entries.clear();
+        recent.clear();
+        totalCost = 0;
+        this->generation = generation;
+    }
+    auto existing = entries.find(pattern);
+    if (!unscanned.isEmpty() && existing != entries.end() && existing->unscanned.size() <= unscanned.size()) {
+        // a canceled query never replaces a more finished entry
+        return;
+    }
+    Entry entry;
+    for (uint32_t trg : patternTrgs) {
+        entry.trgs.insert(trg);
+    }
+    entry.candidates = candidates;
+    entry.results = results;
+    entry.complete = complete;
+    entry.unscanned = unscanned;
+    // the query may have seen the old content of these files
+    for (int i = invalidated.size() - int(this->sequence - sequence); i < invalidated.size(); i++) {
+        entry.candidates.remove(invalidated[i]);
+        entry.results.remove(invalidated[i]);
+        entry.dirty.insert(invalidated[i]);
+    }
+    if (cost(entry) > maxCost) {
+        return;
+    }
+    if (entries.contains(pattern)) {
+        totalCost -= cost(entries[pattern]);
+    }
+    totalCost += cost(entry);
+    entries.insert(pattern, entry);
+    touch(pattern);
+    evict();
+}
+
+quint64 QueryCache::getSequence() {
+    QMutexLocker locker(&mutex);
+    return sequence;
+}
+
+void QueryCache::invalidateFile(QString const& filePath) {
+    QMutexLocker locker(&mutex);
+    sequence++;
+    invalidated.push_back(filePath);
+    if (invalidated.size() > MAX_INVALIDATIONS) {
+        invalidated.removeFirst();
+    }
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        totalCost -= cost(*it);
+        it->candidates.remove(filePath);
+        it->results.remove(filePath);
+        it->dirty.insert(filePath);
+        totalCost += cost(*it);
+    }
+    evict();
+}
+
+void QueryCache::clear() {
+    QMutexLocker locker(&mutex);
+    entries.clear();
+    recent.clear();
+    totalCost = 0;
+}
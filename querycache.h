@@ -0,0 +1,59 @@
+#ifndef QUERYCACHE_H
+#define QUERYCACHE_H
+
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+#include <QVector>
+
+// LRU cache of finished queries for one index generation.
+// Every entry keeps the trigram candidates and the verified results of a pattern,
+// files changed since then are moved into the entry's dirty set and must be checked again.
+// Candidates of a query narrowed from cached results miss the files outside those results,
+// such an entry is incomplete and is only reused through its pattern, never through its trigrams.
+// A canceled query leaves an entry for the shards it finished, the other shards are unscanned.
+// Files invalidated while a query runs are dirty in the entry it inserts, the query reads
+// getSequence() when it starts and passes it to insert().
+class QueryCache {
+public:
+    QueryCache(int maxCost);
+
+    bool find(QString const& pattern, quint64 generation, QSet<QString> &candidates, QSet<QString> &results,
+              QSet<QString> &dirty, bool &complete);
+    bool findSuperset(QString const& pattern, QVector<uint32_t> const& patternTrgs, quint64 generation,
+                      QSet<QString> &superset, QSet<int> &unscanned, bool &complete);
+    void insert(QString const& pattern, QVector<uint32_t> const& patternTrgs, quint64 generation,
+                QSet<QString> const& candidates, QSet<QString> const& results, bool complete,
+                QSet<int> const& unscanned, quint64 sequence);
+    quint64 getSequence();
+    void invalidateFile(QString const& filePath);
+    void clear();
+private:
+    struct Entry {
+        QSet<uint32_t> trgs;
+        QSet<QString> candidates;
+        QSet<QString> results;
+        QSet<QString> dirty;
+        bool complete;
+        QSet<int> unscanned;
+    };
+
+    void touch(QString const& pattern);
+    void evict();
+    static int cost(Entry const& entry);
+
+    static const int MAX_INVALIDATIONS = 1 << 12;
+
+    QMutex mutex;
+    int maxCost, totalCost;
+    quint64 generation;
+    QHash<QString, Entry> entries;
+    QList<QString> recent;
+    // the last files passed to invalidateFile(), sequence counts all of them
+    QList<QString> invalidated;
+    quint64 sequence;
+};
+
+#endif // QUERYCACHE_H
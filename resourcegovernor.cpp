@@ -0,0 +1,114 @@
+#include "resourcegovernor.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+#ifdef Q_OS_LINUX
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+std::atomic<qint64> memoryBudget(0), bytesPerSecond(0);
+std::atomic<int> operationsPerSecond(0), foregroundQueries(0);
+thread_local bool background = false;
+
+// next free moments of the byte and operation buckets, in nanoseconds
+QMutex ioMutex;
+qint64 nextByteSlot = 0, nextOperationSlot = 0;
+
+qint64 now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#ifdef Q_OS_LINUX
+const int IOPRIO_WHO_PROCESS = 1,
+          IOPRIO_CLASS_IDLE = 3,
+          IOPRIO_CLASS_SHIFT = 13;
+#endif
+
+}
+
+void ResourceGovernor::setMemoryBudget(qint64 bytes) {
+    memoryBudget = bytes;
+}
+
+qint64 ResourceGovernor::getMemoryBudget() {
+    return memoryBudget;
+}
+
+void ResourceGovernor::setIoLimits(qint64 bytes, int operations) {
+    bytesPerSecond = bytes;
+    operationsPerSecond = operations;
+}
+
+void ResourceGovernor::enterBackground() {
+    if (background) {
+        return;
+    }
+    background = true;
+#ifdef Q_OS_LINUX
+    // both calls only affect the calling thread when given its tid
+    pid_t tid = syscall(SYS_gettid);
+    setpriority(PRIO_PROCESS, tid, 19);
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+#else
+    QThread::currentThread()->setPriority(QThread::IdlePriority);
+#endif
+}
+
+void ResourceGovernor::waitForForeground() {
+    while (foregroundQueries.load(std::memory_order_relaxed) > 0) {
+        QThread::msleep(BACKOFF_MS);
+    }
+}
+
+void ResourceGovernor::acquireIo(qint64 bytes, int operations) {
+    if (!background) {
+        return;
+    }
+    waitForForeground();
+    qint64 byteLimit = bytesPerSecond.load(std::memory_order_relaxed);
+    int operationLimit = operationsPerSecond.load(std::memory_order_relaxed);
+    if (byteLimit <= 0 && operationLimit <= 0) {
+        return;
+    }
+    qint64 start = now(), wakeUp = start;
+    {
+        QMutexLocker locker(&ioMutex);
+        if (byteLimit > 0 && bytes > 0) {
+            nextByteSlot = std::max(nextByteSlot, start) + bytes * 1000000000 / byteLimit;
+            wakeUp = std::max(wakeUp, nextByteSlot);
+        }
+        if (operationLimit > 0 && operations > 0) {
+            nextOperationSlot = std::max(nextOperationSlot, start) + qint64(operations) * 1000000000 / operationLimit;
+            wakeUp = std::max(wakeUp, nextOperationSlot);
+        }
+    }
+    if (wakeUp > start) {
+        QThread::usleep((wakeUp - start) / 1000);
+    }
+}
+
+void ResourceGovernor::beginForeground() {
+    foregroundQueries.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ResourceGovernor::endForeground() {
+    foregroundQueries.fetch_sub(1, std::memory_order_relaxed);
+}
+
+ForegroundScope::ForegroundScope() {
+    ResourceGovernor::beginForeground();
+}
+
+ForegroundScope::~ForegroundScope() {
+    ResourceGovernor::endForeground();
+}
@@ -0,0 +1,32 @@
+#ifndef RESOURCEGOVERNOR_H
+#define RESOURCEGOVERNOR_H
+
+#include <QtGlobal>
+
+// Limits what background indexing may take from the machine: memory held by
+// resident shards, disk bandwidth and operations per second, and CPU/IO priority.
+// Background threads also back off while foreground queries are running.
+class ResourceGovernor {
+public:
+    static void setMemoryBudget(qint64 bytes);
+    static qint64 getMemoryBudget();
+    static void setIoLimits(qint64 bytesPerSecond, int operationsPerSecond);
+
+    static void enterBackground();
+    static void acquireIo(qint64 bytes, int operations);
+
+    static void beginForeground();
+    static void endForeground();
+private:
+    static void waitForForeground();
+
+    static const int BACKOFF_MS = 5;
+};
+
+class ForegroundScope {
+public:
+    ForegroundScope();
+    ~ForegroundScope();
+};
+
+#endif // RESOURCEGOVERNOR_H
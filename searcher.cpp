@@ -1,43 +1,244 @@
 #include "searcher.h"
 
+#include "instrumentation.h"
+
 #include <QFuture>
+#include <QStandardPaths>
+#include <QTextCodec>
 #include <QtConcurrent/QtConcurrent>
+#include <algorithm>
+#include <memory>
 #include <string>
-Searcher::Searcher(QObject *parent, QVector<QString> const& files) : QObject(parent), files(files), isCanceled(false) {
+Searcher::Searcher(QObject *parent, QVector<QString> const& files) : QObject(parent), files(files), success(false), progressCount(0), totalCount(0), shardsLock(QReadWriteLock::Recursive), generation(0), queryCache(MAX_CACHED_PATHS) {
     connect(&fileWatcher, &QFileSystemWatcher::fileChanged, this, &Searcher::reindex);
+    queryPool.setMaxThreadCount(MAX_RUNNING_QUERIES);
+    QDir().mkpath(QStandardPaths::writableLocation(QStandardPaths::CacheLocation));
+    createShards(MIN_SHARD_COUNT);
 }
 
-Searcher::Searcher(QObject *parent) : QObject(parent) {
+Searcher::Searcher(QObject *parent) : Searcher(parent, QVector<QString>()) {
 
 }
 
 void Searcher::reindex(QString const& filePath) {
-    emit requestReindex();
+    if (QFileInfo(filePath).isFile()) {
+        // editors that save through rename make the watcher drop the path
+        fileWatcher.addPath(filePath);
+    }
+    QtConcurrent::run(&indexPool, [this, filePath]() {
+        ResourceGovernor::enterBackground();
+        // the file is read before shardsLock is taken, the governor may keep it waiting for a while
+        FileStat stat;
+        ResourceGovernor::acquireIo(0, 1);
+        if (!QFileInfo(filePath).isFile() || !FileStat::of(filePath, stat)) {
+            QReadLocker shardsLocker(&shardsLock);
+            shardOf(filePath)->removeFile(filePath);
+            place(filePath, -1);
+        } else {
+            // a single file is always hashed, so a copy added later still finds it
+            quint64 hash = 0;
+            bool hashed = stat.size <= MAX_READABLE_FILE_SIZE && ContentHash::hashFile(filePath, hash);
+            if (!hashed || !storeFile(filePath, stat, hashed, hash, nullptr)) {
+                FileIndex *index = new FileIndex(filePath);
+                if (hashed) {
+                    index->setContentHash(hash);
+                }
+                indexFile(index);
+                storeFile(filePath, stat, hashed, hash, index);
+            }
+        }
+        queryCache.invalidateFile(filePath);
+        enforceMemoryBudget();
+    });
+}
+
+// without an index the file can only be attached to identical content already indexed
+bool Searcher::storeFile(QString const& filePath, FileStat const& stat, bool hashed, quint64 hash, FileIndex *index) {
+    QReadLocker shardsLocker(&shardsLock);
+    IndexShard *source = shardOf(filePath);
+    int target = hashed ? contentShard(hash) : pathShard(filePath);
+    IndexShard *shard = shards[target];
+    if (hashed && shard->attachToContent(filePath, hash)) {
+        delete index;
+    } else if (index != nullptr) {
+        shard->addIndex(index);
+    } else {
+        return false;
+    }
+    if (shard != source) {
+        source->removeFile(filePath);
+    }
+    shard->setFileStat(filePath, stat);
+    place(filePath, target);
+    return true;
+}
+
+void Searcher::updateWatchedPaths(QStringList const& added, QStringList const& removed) {
+    ScopedTimer timer(Instrumentation::WATCH);
+    if (!removed.isEmpty()) {
+        fileWatcher.removePaths(removed);
+    }
+    if (!added.isEmpty()) {
+        Instrumentation::add(Instrumentation::WATCHED_PATHS, added.size());
+        fileWatcher.addPaths(added);
+    }
 }
 
 void Searcher::cancel() {
-    isCanceled = true;
+    QMutexLocker locker(&tokenMutex);
+    if (indexToken) {
+        indexToken->cancel();
+    }
+    if (queryToken) {
+        queryToken->cancel();
+    }
+}
+
+void Searcher::cancelSearch() {
+    QMutexLocker locker(&tokenMutex);
+    if (queryToken) {
+        queryToken->cancel();
+    }
+}
+
+int Searcher::pathShard(QString const& filePath) const {
+    return qHash(filePath) % shards.size();
+}
+
+int Searcher::contentShard(quint64 hash) const {
+    return hash % shards.size();
+}
+
+IndexShard *Searcher::shardOf(QString const& filePath) {
+    QMutexLocker locker(&placementMutex);
+    return shards[placement.value(filePath, pathShard(filePath))];
+}
+
+void Searcher::place(QString const& filePath, int shard) {
+    QMutexLocker locker(&placementMutex);
+    if (shard < 0 || shard == pathShard(filePath)) {
+        placement.remove(filePath);
+    } else {
+        placement.insert(filePath, shard);
+    }
+}
+
+void Searcher::rebuildPlacement() {
+    QMutexLocker locker(&placementMutex);
+    placement.clear();
+    for (IndexShard *shard : shards) {
+        for (QString const& filePath : shard->getFilePaths()) {
+            if (pathShard(filePath) != shard->getId()) {
+                placement.insert(filePath, shard->getId());
+            }
+        }
+    }
+}
+
+void Searcher::createShards(int count) {
+    qDeleteAll(shards);
+    shards.clear();
+    for (int i = 0; i < count; i++) {
+        shards.push_back(new IndexShard(i, count, shardFilePath(i)));
+    }
+}
+
+void Searcher::resizeShards(int count) {
+    QWriteLocker locker(&shardsLock);
+    QVector<IndexShard *> sources = shards;
+    shards.clear();
+    for (int i = 0; i < count; i++) {
+        shards.push_back(new IndexShard(i, count, shardFilePath(i)));
+        // a file left by an earlier layout with this count would be loaded otherwise
+        shards.back()->markDirty();
+    }
+    // shard counts are powers of two, so a file only moves between shards whose ids are equal
+    // modulo the smaller count; such a group is resharded on its own and may spill once complete,
+    // the old files under its names are read by then
+    int larger = qMax(sources.size(), count), smaller = qMin(sources.size(), count);
+    int groups = larger % smaller == 0 ? smaller : 1;
+    qint64 budget = ResourceGovernor::getMemoryBudget();
+    for (int group = 0; group < groups; group++) {
+        for (int i = group; i < sources.size(); i += groups) {
+            // only this source is read back into memory
+            QHash<QString, FileStat> stats;
+            for (FileIndex *index : sources[i]->takeAll(stats)) {
+                IndexShard *shard = shards[index->hasContentHash() ? contentShard(index->getContentHash()) : pathShard(index->getFilePath())];
+                shard->addIndex(index);
+                for (QString const& filePath : index->getFilePaths()) {
+                    if (stats.contains(filePath)) {
+                        shard->setFileStat(filePath, stats.value(filePath));
+                    }
+                }
+            }
+            delete sources[i];
+            sources[i] = nullptr;
+        }
+        if (budget <= 0) {
+            continue;
+        }
+        qint64 total = 0;
+        QVector<IndexShard *> complete;
+        for (IndexShard *shard : shards) {
+            total += shard->memoryUsage();
+            if (shard->getId() % groups <= group) {
+                complete.push_back(shard);
+            }
+        }
+        for (IndexShard *source : sources) {
+            if (source != nullptr) {
+                total += source->memoryUsage();
+            }
+        }
+        spillShards(complete, total, budget);
+    }
+    rebuildPlacement();
+}
+
+QString Searcher::shardFilePath(int id) {
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QString("/shard_%1.idx").arg(id);
 }
 
-void Searcher::fillFileIndecies() {
+QVector<QString> Searcher::fillFileIndecies(CancellationToken const& token) {
+    ScopedTimer timer(Instrumentation::TRAVERSAL);
+    QVector<QString> filePaths;
+    QSet<QString> seen;
     for (auto &dir: files) {
-        if (QThread::currentThread()->isInterruptionRequested()) break;
-        QDirIterator it(dir, QDirIterator::Subdirectories);
+        if (token.isCanceled()) break;
+        if (QFileInfo(dir).isFile()) {
+            Instrumentation::add(Instrumentation::FILES_TRAVERSED);
+            if (!seen.contains(dir)) {
+                seen.insert(dir);
+                filePaths.push_back(dir);
+            }
+            continue;
+        }
+        QDirIterator it(dir, QDir::Files | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+        QString directory;
         while (it.hasNext()) {
-            if (QThread::currentThread()->isInterruptionRequested()) break;
-            QFileInfo file_info = it.fileInfo();
-            if (file_info.isFile()) {
-                fileIndecies.push_back(new FileIndex(file_info.filePath()));
+            if (token.isCanceled()) break;
+            QString filePath = it.next();
+            // entries are listed in batches, so a directory costs about one operation
+            if (it.fileInfo().path() != directory) {
+                directory = it.fileInfo().path();
+                ResourceGovernor::acquireIo(0, 1);
+            }
+            Instrumentation::add(Instrumentation::FILES_TRAVERSED);
+            if (!seen.contains(filePath)) {
+                seen.insert(filePath);
+                filePaths.push_back(filePath);
             }
-            it.next();
         }
     }
+    return filePaths;
 }
 
 Searcher::~Searcher() {
-    for (int i = 0;i < fileIndecies.size();i++) {
-        delete fileIndecies[i];
-    }
+    cancel();
+    queryPool.waitForDone();
+    shardPool.waitForDone();
+    indexPool.waitForDone();
+    qDeleteAll(shards);
 }
 
 bool Searcher::canConvertedToUtf8(const QString &string) {
@@ -65,7 +266,7 @@ void addTrgsToIndex(QString const& string, FileIndex *index) {
     }
 }
 
-QVector<uint32_t> splitStringToTrgs(QString &string) {
+QVector<uint32_t> splitStringToTrgs(QString const& string) {
     QVector<uint32_t> trgs;
     QVector<uint8_t> bytes;
     for (int i = 0; i < string.size(); i++) {
@@ -86,23 +287,45 @@ QVector<uint32_t> splitStringToTrgs(QString &string) {
 }
 
 void Searcher::indexFile(FileIndex *index) {
+    ScopedTimer timer(Instrumentation::INDEX_FILE);
+    Instrumentation::add(Instrumentation::FILES_INDEXED);
     QFile file(index->getFilePath());
     if (file.size() > MAX_READABLE_FILE_SIZE) {
         return;
     }
+    ResourceGovernor::acquireIo(0, 1);
     if (!file.open(QIODevice::ReadOnly)) {
         return;
     }
-    QTextStream in(&file);
+    // reading and decoding are split to time them separately, the codec choice matches QTextStream
+    std::unique_ptr<QTextDecoder> decoder;
     QString data;
-    while (!in.atEnd()) {
-
-        data += in.read(READ_BUFFER_SIZE);
+    while (!file.atEnd()) {
+        QByteArray bytes;
+        {
+            ScopedTimer readTimer(Instrumentation::FILE_READ);
+            bytes = file.read(READ_BUFFER_SIZE);
+        }
+        if (bytes.isEmpty()) {
+            break;
+        }
+        ResourceGovernor::acquireIo(bytes.size(), 0);
+        Instrumentation::add(Instrumentation::BYTES_READ, bytes.size());
+        {
+            ScopedTimer decodeTimer(Instrumentation::DECODE);
+            if (decoder == nullptr) {
+                decoder.reset(QTextCodec::codecForUtfText(bytes, QTextCodec::codecForLocale())->makeDecoder());
+            }
+            data += decoder->toUnicode(bytes);
+        }
         if (!canConvertedToUtf8(data)) {
             index->clearTrgs();
             return;
         }
-        addTrgsToIndex(data, index);
+        {
+            ScopedTimer tokenizeTimer(Instrumentation::TOKENIZE);
+            addTrgsToIndex(data, index);
+        }
         if (index->size() > MAX_TRG_SIZE) {
             index->clearTrgs();
             return;
@@ -111,65 +334,414 @@ void Searcher::indexFile(FileIndex *index) {
     }
 }
 
-void Searcher::setPattern(const QString &string) {
-    pattern = string;
+void Searcher::advanceProgress(int count) {
+    qint64 previous = progressCount.fetch_add(count);
+    qint64 done = previous + count;
+    if (done * 100 / totalCount != previous * 100 / totalCount) {
+        emit progressBarChanged(done * 100 / totalCount);
+    }
 }
 
-bool containsTrg(QVector<uint32_t> pattern_trgs, FileIndex *index) {
-    for (uint32_t const& i : pattern_trgs) {
-        if (!index->containsTrg(i)) {
-            return false;
+void Searcher::statShard(IndexShard *shard, QVector<QString> const& filePaths, CancellationToken const& token,
+                         QHash<QString, FileStat> &changed, QStringList &added, QStringList &removed) {
+    QSet<QString> present;
+    for (QString const& filePath : filePaths) {
+        if (token.isCanceled()) {
+            return;
+        }
+        FileStat stat;
+        bool exists;
+        ResourceGovernor::acquireIo(0, 1);
+        {
+            ScopedTimer timer(Instrumentation::STAT);
+            exists = FileStat::of(filePath, stat);
+        }
+        if (!exists) {
+            advanceProgress(1);
+            continue;
+        }
+        present.insert(filePath);
+        if (shard->isUpToDate(filePath, stat)) {
+            advanceProgress(1);
+            continue;
+        }
+        changed.insert(filePath, stat);
+        if (!shard->contains(filePath)) {
+            added.push_back(filePath);
+        }
+    }
+    for (QString const& filePath : shard->getFilePaths()) {
+        if (!present.contains(filePath)) {
+            shard->removeFile(filePath);
+            place(filePath, -1);
+            removed.push_back(filePath);
         }
     }
-    return true;
 }
 
-void Searcher::search() {
-    for (int i = 0; i< fileIndecies.size(); ++i){
-        if (isCanceled) {
+void Searcher::hashChanges(QVector<Change> &changes, QHash<qint64, int> const& sizeCounts, CancellationToken const& token) {
+    for (Change &change : changes) {
+        if (token.isCanceled()) {
+            return;
+        }
+        // only files of equal size can be identical, so files with a unique size are never hashed
+        change.hashed = sizeCounts.value(change.stat.size) > 1 && change.stat.size <= MAX_READABLE_FILE_SIZE
+                && ContentHash::hashFile(change.filePath, change.hash);
+    }
+}
+
+void Searcher::applyChanges(IndexShard *shard, QVector<Change> const& changes, CancellationToken const& token) {
+    QHash<quint64, FileIndex *> byHash;
+    QVector<FileIndex *> pending;
+    QVector<QPair<QString, FileStat>> stats;
+    for (Change const& change : changes) {
+        if (token.isCanceled()) {
             break;
         }
-        emit progressBarChanged((i * 100) / fileIndecies.size());
-        QVector<uint32_t> pattern_trgs = splitStringToTrgs(pattern);
-        if (containsTrg(pattern_trgs, fileIndecies[i])) {
-            QFile file(fileIndecies[i]->getFilePath());
-            if (file.open(QFile::ReadOnly)) {
-                QString line;
-                while (!file.atEnd()) {
-                    if (isCanceled) {
-                        break;
-                    }
-                    line += file.read(1000);
-                    if (line.indexOf(pattern) >= 0) {
-                        emit itemAdded(fileIndecies[i]->getFilePath());
-                        break;
-                    }
-                    line = line.mid(line.size()-pattern.size(), pattern.size());
-                }
+        IndexShard *source = shardOf(change.filePath);
+        FileIndex *index = nullptr;
+        FileStat stat = change.stat;
+        if (change.indexed) {
+            // the file is unchanged, its trigrams move with it into the shard of its content
+            index = source->takeFile(change.filePath, stat);
+            if (index == nullptr) {
+                continue;
+            }
+        } else {
+            advanceProgress(1);
+            if (source != shard) {
+                source->removeFile(change.filePath);
             }
         }
+        stats.push_back(qMakePair(change.filePath, stat));
+        if (change.hashed && byHash.contains(change.hash)) {
+            byHash[change.hash]->addFilePath(change.filePath);
+            delete index;
+            continue;
+        }
+        if (change.hashed && shard->attachToContent(change.filePath, change.hash)) {
+            delete index;
+            continue;
+        }
+        if (index == nullptr) {
+            index = new FileIndex(change.filePath);
+            indexFile(index);
+        }
+        if (change.hashed) {
+            index->setContentHash(change.hash);
+            byHash.insert(change.hash, index);
+        }
+        pending.push_back(index);
     }
-    isCanceled = false;
-    emit finished();
+    for (FileIndex *index : pending) {
+        shard->addIndex(index);
+    }
+    for (auto const& stat : stats) {
+        shard->setFileStat(stat.first, stat.second);
+        place(stat.first, shard->getId());
+    }
+}
+
+void Searcher::loadShards() {
+    int count = IndexShard::readShardCount(shardFilePath(0));
+    if (count > 0 && count != shards.size()) {
+        QWriteLocker locker(&shardsLock);
+        createShards(count);
+    }
+    // the paths of every shard stay in memory, trigrams only as long as they fit into the budget;
+    // the other shards are loaded spilled, their files already hold the current state
+    qint64 budget = ResourceGovernor::getMemoryBudget(), total = 0;
+    QVector<qint64> spilledUsage(shards.size(), 0), residentUsage(shards.size(), 0);
+    for (IndexShard *shard : shards) {
+        shard->readMemoryUsage(spilledUsage[shard->getId()], residentUsage[shard->getId()]);
+        total += spilledUsage[shard->getId()];
+    }
+    QVector<QFuture<void>> loads;
+    for (IndexShard *shard : shards) {
+        qint64 trgUsage = residentUsage[shard->getId()] - spilledUsage[shard->getId()];
+        bool spill = budget > 0 && total + trgUsage > budget;
+        if (!spill) {
+            total += trgUsage;
+        }
+        loads.push_back(QtConcurrent::run(&indexPool, [shard, spill]() {
+            ResourceGovernor::enterBackground();
+            shard->load(spill);
+        }));
+    }
+    for (auto &load : loads) {
+        load.waitForFinished();
+    }
+    rebuildPlacement();
+}
+
+void Searcher::enforceMemoryBudget() {
+    qint64 budget = ResourceGovernor::getMemoryBudget();
+    if (budget <= 0) {
+        return;
+    }
+    QReadLocker shardsLocker(&shardsLock);
+    QMutexLocker locker(&budgetMutex);
+    qint64 total = 0;
+    for (IndexShard *shard : shards) {
+        total += shard->memoryUsage();
+    }
+    spillShards(shards, total, budget);
+}
+
+// the largest resident shards are spilled first until the total fits into the budget
+void Searcher::spillShards(QVector<IndexShard *> const& spillable, qint64 total, qint64 budget) {
+    QVector<QPair<qint64, IndexShard *>> resident;
+    for (IndexShard *shard : spillable) {
+        if (!shard->isSpilled()) {
+            resident.push_back(qMakePair(shard->memoryUsage(), shard));
+        }
+    }
+    std::sort(resident.begin(), resident.end(), [](QPair<qint64, IndexShard *> const& a, QPair<qint64, IndexShard *> const& b) {
+        return a.first > b.first;
+    });
+    for (auto const& shard : resident) {
+        if (total <= budget) {
+            break;
+        }
+        if (shard.second->spill()) {
+            total -= shard.first - shard.second->memoryUsage();
+        }
+    }
+}
+
+void Searcher::saveShards() {
+    QVector<QFuture<void>> saves;
+    for (IndexShard *shard : shards) {
+        if (!shard->isDirty()) {
+            continue;
+        }
+        saves.push_back(QtConcurrent::run(&indexPool, [shard]() {
+            ResourceGovernor::enterBackground();
+            if (!shard->save()) {
+                qDebug() << "can't save shard" << shard->getId();
+            }
+        }));
+    }
+    for (auto &save : saves) {
+        save.waitForFinished();
+    }
+}
+
+void Searcher::startSearch(QString const& pattern, quint64 queryId) {
+    CancellationTokenPtr token = std::make_shared<CancellationToken>();
+    QMutexLocker locker(&tokenMutex);
+    if (queryToken) {
+        queryToken->cancel();
+    }
+    queryToken = token;
+    QFuture<void> previous = lastQuery;
+    lastQuery = QtConcurrent::run(&queryPool, [this, pattern, queryId, token, previous]() mutable {
+        // the canceled predecessor returns quickly and leaves its partial candidates in the cache
+        previous.waitForFinished();
+        search(pattern, queryId, token);
+    });
+}
+
+namespace {
+
+struct ShardResult {
+    QVector<QString> results, candidates;
+    bool complete;
+};
+
+}
+
+void Searcher::search(QString const& pattern, quint64 queryId, CancellationTokenPtr token) {
+    // the shard layout can only change between queries; a query waiting for a resize is not foreground
+    // yet, or the resize would wait for background work that waits for this query
+    QReadLocker shardsLocker(&shardsLock);
+    ForegroundScope foreground;
+    ScopedTimer timer(Instrumentation::QUERY);
+    Instrumentation::add(Instrumentation::QUERIES);
+    QVector<uint32_t> pattern_trgs = splitStringToTrgs(pattern);
+    quint64 queryGeneration = generation;
+    quint64 invalidations = queryCache.getSequence();
+    QSet<QString> candidates, results, scope;
+    QSet<int> unscanned;
+    // on an exact hit only the dirty files are checked again and merged into the cached sets
+    bool complete = true;
+    bool cached = queryCache.find(pattern, queryGeneration, candidates, results, scope, complete);
+    bool scoped = cached || queryCache.findSuperset(pattern, pattern_trgs, queryGeneration, scope, unscanned, complete);
+    if (scoped) {
+        Instrumentation::add(Instrumentation::QUERY_CACHE_HITS);
+    }
+    for (QString const& filePath : results) {
+        emit itemAdded(queryId, filePath);
+    }
+    QVector<QVector<QString>> shardScopes(shards.size());
+    for (QString const& filePath : scope) {
+        shardScopes[shardOf(filePath)->getId()].push_back(filePath);
+    }
+    QVector<QFuture<ShardResult>> queries;
+    for (IndexShard *shard : shards) {
+        // the cached scope says nothing about shards its query did not finish
+        bool within = scoped && !unscanned.contains(shard->getId());
+        QVector<QString> shardScope = shardScopes[shard->getId()];
+        queries.push_back(QtConcurrent::run(&shardPool, [shard, pattern, pattern_trgs, within, shardScope, token]() {
+            ShardResult found;
+            if (within) {
+                found.results = shard->searchWithin(shardScope, pattern, pattern_trgs, *token, found.candidates);
+            } else {
+                found.results = shard->search(pattern, pattern_trgs, *token, found.candidates);
+            }
+            found.complete = !token->isCanceled();
+            return found;
+        }));
+    }
+    QSet<int> pending;
+    for (int i = 0; i < queries.size(); ++i) {
+        ShardResult found = queries[i].result();
+        if (!found.complete) {
+            pending.insert(shards[i]->getId());
+            continue;
+        }
+        for (QString const& filePath : found.results) {
+            results.insert(filePath);
+            emit itemAdded(queryId, filePath);
+        }
+        for (QString const& filePath : found.candidates) {
+            candidates.insert(filePath);
+        }
+        emit progressBarChanged(((i + 1) * 100) / queries.size());
+    }
+    // an exact hit keeps its cached entry when canceled, any other query caches the shards it finished
+    if (pending.isEmpty() || (!cached && pending.size() < shards.size())) {
+        queryCache.insert(pattern, pattern_trgs, queryGeneration, candidates, results, complete, pending, invalidations);
+    }
+    emit searchFinished(queryId);
 }
 
 void Searcher::process() {
+    CancellationTokenPtr token = std::make_shared<CancellationToken>();
+    {
+        QMutexLocker locker(&tokenMutex);
+        indexToken = token;
+    }
     success = false;
-    fillFileIndecies();
-    for (int i = 0; i < fileIndecies.size(); ++i) {
-        if (isCanceled) {
-            fileIndecies.clear();
-            break;
+    progressCount = 0;
+    ++generation;
+    queryCache.clear();
+    bool empty = true;
+    for (IndexShard *shard : shards) {
+        empty = empty && shard->size() == 0;
+    }
+    if (empty) {
+        loadShards();
+    }
+    QVector<QString> filePaths;
+    // the traversal is background work like the rest of indexing, process() itself runs on the global pool
+    QtConcurrent::run(&indexPool, [this, &filePaths, token]() {
+        ResourceGovernor::enterBackground();
+        filePaths = fillFileIndecies(*token);
+    }).waitForFinished();
+    totalCount = filePaths.size();
+    // shards are kept between a quarter and all of MAX_FILES_PER_SHARD files on average
+    int count = shards.size();
+    while (qint64(count) * MAX_FILES_PER_SHARD < filePaths.size()) {
+        count *= 2;
+    }
+    while (count > MIN_SHARD_COUNT && qint64(count) * MAX_FILES_PER_SHARD / 4 > filePaths.size()) {
+        count /= 2;
+    }
+    if (count != shards.size() && !token->isCanceled()) {
+        resizeShards(count);
+    }
+    QVector<QVector<QString>> shardFiles(shards.size());
+    for (QString const& filePath : filePaths) {
+        shardFiles[shardOf(filePath)->getId()].push_back(filePath);
+    }
+    QVector<QHash<QString, FileStat>> changed(shards.size());
+    QVector<QStringList> added(shards.size()), removed(shards.size());
+    QVector<QFuture<void>> stats;
+    for (IndexShard *shard : shards) {
+        int id = shard->getId();
+        QVector<QString> const* shardPaths = &shardFiles[id];
+        QHash<QString, FileStat> *shardChanged = &changed[id];
+        QStringList *shardAdded = &added[id];
+        QStringList *shardRemoved = &removed[id];
+        stats.push_back(QtConcurrent::run(&indexPool, [this, shard, shardPaths, shardChanged, shardAdded, shardRemoved, token]() {
+            ResourceGovernor::enterBackground();
+            statShard(shard, *shardPaths, *token, *shardChanged, *shardAdded, *shardRemoved);
+        }));
+    }
+    for (auto &stat : stats) {
+        stat.waitForFinished();
+    }
+    // a changed file is hashed when any other file, indexed or changed, has its size;
+    // an indexed file without a hash is hashed too once a changed file of its size appears
+    QHash<qint64, int> sizeCounts;
+    QHash<qint64, QVector<QString>> unhashed;
+    for (IndexShard *shard : shards) {
+        shard->collectSizes(changed[shard->getId()], sizeCounts, unhashed);
+    }
+    QVector<QVector<Change>> bySource(shards.size());
+    QSet<qint64> changedSizes;
+    for (int i = 0; i < shards.size(); i++) {
+        for (auto it = changed[i].begin(); it != changed[i].end(); ++it) {
+            sizeCounts[it->size]++;
+            changedSizes.insert(it->size);
+            bySource[i].push_back({it.key(), *it, false, false, 0});
+        }
+    }
+    for (qint64 size : changedSizes) {
+        if (sizeCounts.value(size) < 2) {
+            continue;
+        }
+        for (QString const& filePath : unhashed.value(size)) {
+            FileStat stat = {0, size, 0};
+            bySource[shardOf(filePath)->getId()].push_back({filePath, stat, true, false, 0});
         }
-        emit progressBarChanged((i * 100) / fileIndecies.size());
-        fileWatcher.addPath(fileIndecies[i]->getFilePath());
-        indexFile(fileIndecies[i]);
     }
-    qDebug()<< fileIndecies.size()<<'\n';
-    if (!isCanceled) {
+    QVector<QFuture<void>> hashes;
+    for (int i = 0; i < shards.size(); i++) {
+        QVector<Change> *changes = &bySource[i];
+        hashes.push_back(QtConcurrent::run(&indexPool, [this, changes, &sizeCounts, token]() {
+            ResourceGovernor::enterBackground();
+            hashChanges(*changes, sizeCounts, *token);
+        }));
+    }
+    for (auto &hash : hashes) {
+        hash.waitForFinished();
+    }
+    QVector<QVector<Change>> byTarget(shards.size());
+    for (auto const& changes : bySource) {
+        for (Change const& change : changes) {
+            if (change.hashed) {
+                byTarget[contentShard(change.hash)].push_back(change);
+            } else if (!change.indexed) {
+                byTarget[pathShard(change.filePath)].push_back(change);
+            }
+        }
+    }
+    QVector<QFuture<void>> updates;
+    for (IndexShard *shard : shards) {
+        QVector<Change> const* changes = &byTarget[shard->getId()];
+        updates.push_back(QtConcurrent::run(&indexPool, [this, shard, changes, token]() {
+            ResourceGovernor::enterBackground();
+            applyChanges(shard, *changes, *token);
+            enforceMemoryBudget();
+        }));
+    }
+    for (auto &update : updates) {
+        update.waitForFinished();
+    }
+    QStringList watched, unwatched;
+    for (int i = 0; i < shards.size(); i++) {
+        unwatched += removed[i];
+        // a loaded index is not watched yet, so every present file is new to the watcher
+        watched += empty ? QStringList(shardFiles[i].toList()) : added[i];
+    }
+    // QFileSystemWatcher is not thread safe, so it is only touched from the Searcher's thread
+    QMetaObject::invokeMethod(this, "updateWatchedPaths", Qt::QueuedConnection,
+                              Q_ARG(QStringList, watched), Q_ARG(QStringList, unwatched));
+    if (!token->isCanceled()) {
+        saveShards();
         success = true;
     }
-    isCanceled = false;
     emit finished();
 }
-
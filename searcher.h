@@ -1,12 +1,22 @@
 #ifndef SEARCHER_H
 #define SEARCHER_H
 
+#include "cancellationtoken.h"
+#include "contenthash.h"
 #include "fileindex.h"
+#include "indexshard.h"
+#include "querycache.h"
+#include "resourcegovernor.h"
 
 #include <QFileInfo>
 #include <QFileSystemWatcher>
+#include <QFuture>
+#include <QMutex>
 #include <QObject>
+#include <QReadWriteLock>
+#include <QThreadPool>
 #include <QVector>
+#include <atomic>
 
 class Searcher : public QObject
 {
@@ -23,28 +33,64 @@ public:
 
     void indexFile(FileIndex *index);
 
-    void setPattern(QString const& string);
+    void startSearch(QString const& pattern, quint64 queryId);
 
     QVector<QString> files;
 
     bool success;
 private:
-    void fillFileIndecies();
+    QVector<QString> fillFileIndecies(CancellationToken const& token);
+    // a traversed file whose stat changed, or an unchanged file that needs a hash
+    struct Change {
+        QString filePath;
+        FileStat stat;
+        bool indexed;
+        bool hashed;
+        quint64 hash;
+    };
+
+    void statShard(IndexShard *shard, QVector<QString> const& filePaths, CancellationToken const& token,
+                   QHash<QString, FileStat> &changed, QStringList &added, QStringList &removed);
+    void hashChanges(QVector<Change> &changes, QHash<qint64, int> const& sizeCounts, CancellationToken const& token);
+    void applyChanges(IndexShard *shard, QVector<Change> const& changes, CancellationToken const& token);
+    bool storeFile(QString const& filePath, FileStat const& stat, bool hashed, quint64 hash, FileIndex *index);
+    void advanceProgress(int count);
+    void search(QString const& pattern, quint64 queryId, CancellationTokenPtr token);
+    void saveShards();
+    void loadShards();
+    void createShards(int count);
+    void resizeShards(int count);
+    void enforceMemoryBudget();
+    void spillShards(QVector<IndexShard *> const& spillable, qint64 total, qint64 budget);
+    IndexShard *shardOf(QString const& filePath);
+    int pathShard(QString const& filePath) const;
+    int contentShard(quint64 hash) const;
+    void place(QString const& filePath, int shard);
+    void rebuildPlacement();
+    QString shardFilePath(int id);
     bool canConvertedToUtf8(QString const& string);
     QVector<uint32_t> splitIntoTrgs(QString const& string);
     const int MAX_READABLE_FILE_SIZE = 1 << 30,
               READ_BUFFER_SIZE = 1000,
-              MAX_TRG_SIZE = 20000;
+              MAX_TRG_SIZE = 20000,
+              MIN_SHARD_COUNT = 32,
+              MAX_FILES_PER_SHARD = 1 << 16,
+              MAX_CACHED_PATHS = 1 << 20,
+              MAX_RUNNING_QUERIES = 4;
 public slots:
 
     void process();
 
-    void search();
-
     void cancel();
 
+    void cancelSearch();
+
     void reindex(QString const &filePath);
 
+private slots:
+
+    void updateWatchedPaths(QStringList const& added, QStringList const& removed);
+
 signals:
     void progressBarChanged(int percent);
 
@@ -52,18 +98,28 @@ signals:
 
     void error(QString err);
 
-    void itemAdded(QString path);
+    void itemAdded(quint64 queryId, QString path);
 
-    void requestReindex();
+    void searchFinished(quint64 queryId);
 private:
     QFileSystemWatcher fileWatcher;
+    QThreadPool indexPool, shardPool, queryPool;
     void indexFiles();
 
-    bool isCanceled;
-
-    int progressCount;
-    QVector<FileIndex *> fileIndecies;
-    QString pattern;
+    QMutex tokenMutex, budgetMutex;
+    CancellationTokenPtr indexToken, queryToken;
+    QFuture<void> lastQuery;
+
+    std::atomic<int> progressCount;
+    int totalCount;
+    // the shard count follows the number of files, shardsLock guards the vector against resizing
+    QVector<IndexShard *> shards;
+    QReadWriteLock shardsLock;
+    // paths kept outside the shard of their path hash, that is hashed files placed by content
+    QHash<QString, int> placement;
+    QMutex placementMutex;
+    std::atomic<quint64> generation;
+    QueryCache queryCache;
 };
 
 